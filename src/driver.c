@@ -1,5 +1,661 @@
 #include "rbtree.h"
 
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum { OP_INSERT, OP_FIND, OP_ERASE, OP_MIN, OP_MAX, OP_ARRAY, OP_COUNT } op_t;
+static const char *op_names[OP_COUNT] = {"insert", "find", "erase", "min", "max", "to_array"};
+
+typedef enum { DIST_UNIFORM, DIST_SEQUENTIAL, DIST_ZIPF, DIST_DUP, DIST_REVERSE, DIST_JITTER, DIST_COUNT } dist_t;
+static const char *dist_names[DIST_COUNT] = {"uniform", "sequential", "zipf", "dup", "reverse", "jitter"};
+
+typedef enum { FMT_TEXT, FMT_CSV, FMT_JSON } fmt_t;
+
+#if defined(RBTREE_COMPACT) && defined(RBTREE_COUNTED)
+static const char *layout = "compact-counted";
+#elif defined(RBTREE_COMPACT)
+static const char *layout = "compact";
+#elif defined(RBTREE_COUNTED)
+static const char *layout = "pointer-counted";
+#else
+static const char *layout = "pointer";
+#endif
+
+typedef struct {
+  size_t ops;
+  size_t prefill;
+  size_t range;
+  dist_t dist;
+  double theta;
+  unsigned weights[OP_COUNT];
+  uint64_t seed;
+  fmt_t fmt;
+  int threads;  // 0이면 단일 thread 측정, 아니면 rbtree_mt로 1..threads thread 처리량 측정
+  int shards;   // 0보다 크면 rbtree_mt 대신 shard 수가 shards인 rbtree_sharded를 사용
+  size_t batch; // 0보다 크면 rbtree_find 반복과 batch 크기의 rbtree_find_batch를 비교
+  int hint;     // 삽입할 때 직전에 넣은 노드를 hint로 rbtree_insert_hint 사용
+  const char *wal;          // NULL이 아니면 이 경로의 snapshot과 "경로.log"에 변경을 기록하는 rbtree_wal 사용
+  size_t wal_bytes;         // group commit byte 기준
+  unsigned int wal_ms;      // group commit 시간 기준
+  int compact;              // 미리 넣은 뒤 rbtree_compact로 노드를 재배치하고 측정
+} config_t;
+
+// 연산별 지연 시간(ns) 기록
+typedef struct {
+  uint64_t *lat;
+  size_t n, cap;
+  uint64_t total;
+} samples_t;
+
+// key stream 생성기
+typedef struct {
+  dist_t dist;
+  uint64_t rng;
+  size_t range;
+  size_t seq;
+  double theta, alpha, zetan, eta;
+} keygen_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64* 난수
+static uint64_t next_rand(uint64_t *s) {
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 2685821657736338717ull;
+}
+
+static double next_unit(uint64_t *s) {
+  return (next_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double zeta(size_t n, double theta) {
+  double sum = 0;
+  for (size_t i = 1; i <= n; i++) sum += 1.0 / pow((double)i, theta);
+  return sum;
+}
+
+static void keygen_init(keygen_t *g, const config_t *c) {
+  memset(g, 0, sizeof(*g));
+  g->dist = c->dist;
+  g->rng = c->seed ? c->seed : 1;
+  g->range = c->range ? c->range : 1;
+  if (g->dist == DIST_ZIPF) {
+    // Gray et al., "Quickly Generating Billion-Record Synthetic Databases"
+    g->theta = c->theta;
+    g->alpha = 1.0 / (1.0 - g->theta);
+    g->zetan = zeta(g->range, g->theta);
+    g->eta = (1.0 - pow(2.0 / g->range, 1.0 - g->theta)) / (1.0 - zeta(2, g->theta) / g->zetan);
+  }
+}
+
+static key_t keygen_next(keygen_t *g) {
+  switch (g->dist) {
+    case DIST_SEQUENTIAL:
+      return (key_t)(g->seq++ % g->range);
+    case DIST_ZIPF: {
+      double u = next_unit(&g->rng);
+      double uz = u * g->zetan;
+      if (uz < 1.0) return 0;
+      if (uz < 1.0 + pow(0.5, g->theta)) return 1;
+      return (key_t)(g->range * pow(g->eta * u - g->eta + 1.0, g->alpha));
+    }
+    case DIST_REVERSE:
+      return (key_t)(g->range - 1 - g->seq++ % g->range);
+    case DIST_JITTER:                               // 순서대로 증가하되 ±16 안에서 흔들리는 stream
+      return (key_t)((g->seq++ + next_rand(&g->rng) % 33) % g->range);
+    case DIST_DUP:                                  // 서로 다른 key가 range/1024개 뿐인 stream
+      return (key_t)(next_rand(&g->rng) % (g->range / 1024 + 1));
+    default:
+      return (key_t)(next_rand(&g->rng) % g->range);
+  }
+}
+
+static void samples_add(samples_t *s, uint64_t ns) {
+  if (s->n == s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 1024;
+    s->lat = realloc(s->lat, s->cap * sizeof(uint64_t));
+    if (s->lat == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  s->lat[s->n++] = ns;
+  s->total += ns;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const samples_t *s, double q) {
+  if (s->n == 0) return 0;
+  size_t i = (size_t)(q * (s->n - 1));
+  return s->lat[i];
+}
+
+static int parse_mix(const char *arg, unsigned *w) {
+  char *buf = strdup(arg), *save = NULL;
+  memset(w, 0, sizeof(unsigned) * OP_COUNT);
+  for (char *tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    char *eq = strchr(tok, '=');
+    if (eq == NULL) goto fail;
+    *eq = '\0';
+    int op;
+    for (op = 0; op < OP_COUNT; op++)
+      if (strcmp(tok, op_names[op]) == 0) break;
+    if (op == OP_COUNT) goto fail;
+    w[op] = (unsigned)strtoul(eq + 1, NULL, 10);
+  }
+  free(buf);
+  return 0;
+fail:
+  free(buf);
+  return 1;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-n ops] [-p prefill] [-r key_range] [-k uniform|sequential|zipf|dup|reverse|jitter]\n"
+          "          [-z zipf_theta] [-m insert=50,find=40,erase=10,min=0,max=0,to_array=0]\n"
+          "          [-s seed] [-o text|csv|json] [-t max_threads] [-S shards] [-b batch] [-H]\n"
+          "          [-L wal_path] [-G sync_bytes] [-I sync_ms] [-C]\n",
+          prog);
+  exit(2);
+}
+
+static void parse_args(config_t *c, int argc, char *argv[]) {
+  int opt;
+  c->ops = 1000000;
+  c->prefill = 100000;
+  c->range = 0;
+  c->dist = DIST_UNIFORM;
+  c->theta = 0.99;
+  c->seed = 17;
+  c->fmt = FMT_TEXT;
+  c->threads = 0;
+  c->shards = 0;
+  c->batch = 0;
+  c->hint = 0;
+  c->wal = NULL;
+  c->wal_bytes = 65536;
+  c->wal_ms = 10;
+  c->compact = 0;
+  parse_mix("insert=50,find=40,erase=10", c->weights);
+  while ((opt = getopt(argc, argv, "n:p:r:k:z:m:s:o:t:S:b:HL:G:I:Ch")) != -1) {
+    switch (opt) {
+      case 'n': c->ops = strtoull(optarg, NULL, 10); break;
+      case 'p': c->prefill = strtoull(optarg, NULL, 10); break;
+      case 'r': c->range = strtoull(optarg, NULL, 10); break;
+      case 'z': c->theta = strtod(optarg, NULL); break;
+      case 's': c->seed = strtoull(optarg, NULL, 10); break;
+      case 't': c->threads = atoi(optarg); break;
+      case 'S': c->shards = atoi(optarg); break;
+      case 'b': c->batch = strtoull(optarg, NULL, 10); break;
+      case 'H': c->hint = 1; break;
+      case 'L': c->wal = optarg; break;
+      case 'G': c->wal_bytes = strtoull(optarg, NULL, 10); break;
+      case 'I': c->wal_ms = (unsigned int)strtoul(optarg, NULL, 10); break;
+      case 'C': c->compact = 1; break;
+      case 'k': {
+        int d;
+        for (d = 0; d < DIST_COUNT; d++)
+          if (strcmp(optarg, dist_names[d]) == 0) break;
+        if (d == DIST_COUNT) usage(argv[0]);
+        c->dist = (dist_t)d;
+        break;
+      }
+      case 'm':
+        if (parse_mix(optarg, c->weights)) usage(argv[0]);
+        break;
+      case 'o':
+        if (strcmp(optarg, "text") == 0) c->fmt = FMT_TEXT;
+        else if (strcmp(optarg, "csv") == 0) c->fmt = FMT_CSV;
+        else if (strcmp(optarg, "json") == 0) c->fmt = FMT_JSON;
+        else usage(argv[0]);
+        break;
+      default: usage(argv[0]);
+    }
+  }
+  if (c->threads < 0 || c->threads > 1024 || c->shards < 0) usage(argv[0]);
+  if ((c->batch > 0 || c->hint) && c->threads > 0) usage(argv[0]);
+  if (c->compact && c->threads > 0) usage(argv[0]);
+  if (c->wal != NULL && (c->batch > 0 || c->hint || c->threads > 0 || c->shards > 0)) usage(argv[0]);
+  if (c->shards > 0 && c->threads == 0) c->threads = 1;
+  if (c->range == 0) c->range = c->prefill + c->ops;
+  if (c->dist == DIST_ZIPF && (c->theta <= 0 || c->theta == 1.0)) usage(argv[0]);
+}
+
+static op_t pick_op(const config_t *c, unsigned total, uint64_t *rng) {
+  unsigned r = (unsigned)(next_rand(rng) % total);
+  for (int op = 0; op < OP_COUNT; op++) {
+    if (r < c->weights[op]) return (op_t)op;
+    r -= c->weights[op];
+  }
+  return OP_FIND;
+}
+
+// wal이 NULL이 아니면 변경 하나당 log 비용을 함께 출력
+static void report(const config_t *c, samples_t *s, uint64_t elapsed, const rbtree *t, const rbtree_wal_stats_t *wal) {
+  size_t done = 0;
+  for (int op = 0; op < OP_COUNT; op++) {
+    qsort(s[op].lat, s[op].n, sizeof(uint64_t), cmp_u64);
+    done += s[op].n;
+  }
+  double total_ops = done / (elapsed / 1e9);
+  size_t keys = rbtree_size(t);
+  double bytes_per_key = keys ? (double)rbtree_memory(t) / keys : 0;
+  rbtree_stats_t st;
+  rbtree_stats(t, &st);
+  double depth_sum = 0;
+  for (int d = 0; d < RBTREE_STATS_MAX_DEPTH; d++) depth_sum += (double)d * st.depth_hist[d];
+  double avg_depth = st.nodes ? depth_sum / st.nodes : 0;
+  double wal_bytes = wal && wal->records ? (double)wal->bytes / wal->records : 0;
+  double wal_batch = wal && wal->syncs ? (double)wal->records / wal->syncs : 0;
+#ifdef RBTREE_STATS
+  const rbtree_counters_t *k = &st.counters;
+  double per_op = done ? 1.0 / done : 0;
+#endif
+
+  if (c->fmt == FMT_CSV) {
+    printf("op,dist,layout,count,ops_per_sec,p50_ns,p99_ns,p999_ns,bytes_per_key\n");
+    for (int op = 0; op < OP_COUNT; op++) {
+      if (s[op].n == 0) continue;
+      printf("%s,%s,%s,%zu,%.0f,%llu,%llu,%llu,%.2f\n", op_names[op], dist_names[c->dist], layout,
+             s[op].n, s[op].n / (s[op].total / 1e9), (unsigned long long)percentile(&s[op], 0.50),
+             (unsigned long long)percentile(&s[op], 0.99),
+             (unsigned long long)percentile(&s[op], 0.999), bytes_per_key);
+    }
+    printf("total,%s,%s,%zu,%.0f,,,,%.2f\n", dist_names[c->dist], layout, done, total_ops,
+           bytes_per_key);
+    if (wal != NULL)
+      printf("\nwal_records,wal_syncs,log_bytes_per_record,records_per_sync\n%llu,%llu,%.2f,%.2f\n",
+             (unsigned long long)wal->records, (unsigned long long)wal->syncs, wal_bytes, wal_batch);
+  } else if (c->fmt == FMT_JSON) {
+    printf("{\"dist\":\"%s\",\"ops\":%zu,\"prefill\":%zu,\"range\":%zu,\"seed\":%llu,"
+           "\"layout\":\"%s\",\"node_bytes\":%zu,\"keys\":%zu,\"bytes_per_key\":%.2f,"
+           "\"ops_per_sec\":%.0f,\"height\":%d,\"black_height\":%d,\"avg_depth\":%.2f,",
+           dist_names[c->dist], done, c->prefill, c->range, (unsigned long long)c->seed, layout,
+           sizeof(node_t), keys, bytes_per_key, total_ops, st.height, st.black_height, avg_depth);
+#ifdef RBTREE_STATS
+    printf("\"counters\":{\"comparisons\":%llu,\"rotations\":%llu,\"insert_fixups\":%llu,"
+           "\"erase_fixups\":%llu,\"allocs\":%llu,\"frees\":%llu},",
+           (unsigned long long)k->comparisons, (unsigned long long)k->rotations,
+           (unsigned long long)k->insert_fixups, (unsigned long long)k->erase_fixups,
+           (unsigned long long)k->allocs, (unsigned long long)k->frees);
+#endif
+    if (wal != NULL)
+      printf("\"wal\":{\"records\":%llu,\"syncs\":%llu,\"bytes_per_record\":%.2f,\"records_per_sync\":%.2f},",
+             (unsigned long long)wal->records, (unsigned long long)wal->syncs, wal_bytes, wal_batch);
+    printf("\"results\":[");
+    int first = 1;
+    for (int op = 0; op < OP_COUNT; op++) {
+      if (s[op].n == 0) continue;
+      printf("%s{\"op\":\"%s\",\"count\":%zu,\"ops_per_sec\":%.0f,\"p50_ns\":%llu,"
+             "\"p99_ns\":%llu,\"p999_ns\":%llu}",
+             first ? "" : ",", op_names[op], s[op].n, s[op].n / (s[op].total / 1e9),
+             (unsigned long long)percentile(&s[op], 0.50),
+             (unsigned long long)percentile(&s[op], 0.99),
+             (unsigned long long)percentile(&s[op], 0.999));
+      first = 0;
+    }
+    printf("]}\n");
+  } else {
+    printf("dist=%s ops=%zu prefill=%zu range=%zu seed=%llu\n", dist_names[c->dist], done,
+           c->prefill, c->range, (unsigned long long)c->seed);
+    printf("%-10s %10s %14s %10s %10s %10s\n", "op", "count", "ops/sec", "p50(ns)", "p99(ns)",
+           "p999(ns)");
+    for (int op = 0; op < OP_COUNT; op++) {
+      if (s[op].n == 0) continue;
+      printf("%-10s %10zu %14.0f %10llu %10llu %10llu\n", op_names[op], s[op].n,
+             s[op].n / (s[op].total / 1e9), (unsigned long long)percentile(&s[op], 0.50),
+             (unsigned long long)percentile(&s[op], 0.99),
+             (unsigned long long)percentile(&s[op], 0.999));
+    }
+    printf("%-10s %10zu %14.0f\n", "total", done, total_ops);
+    printf("layout=%s node=%zuB keys=%zu bytes/key=%.2f\n", layout, sizeof(node_t), keys,
+           bytes_per_key);
+    printf("height=%d black_height=%d avg_depth=%.2f\n", st.height, st.black_height, avg_depth);
+    if (wal != NULL)
+      printf("wal: records=%llu syncs=%llu log_bytes/record=%.2f records/sync=%.2f\n",
+             (unsigned long long)wal->records, (unsigned long long)wal->syncs, wal_bytes, wal_batch);
+#ifdef RBTREE_STATS
+    printf("per op: comparisons=%.2f rotations=%.3f insert_fixups=%.3f erase_fixups=%.3f "
+           "allocs=%.3f frees=%.3f\n",
+           k->comparisons * per_op, k->rotations * per_op, k->insert_fixups * per_op,
+           k->erase_fixups * per_op, k->allocs * per_op, k->frees * per_op);
+#endif
+  }
+}
+
+// 단일 thread로 연산별 지연 시간을 측정
+// -C: 미리 넣은 노드를 재배치하고 걸린 시간을 stderr에 출력 (측정 구간에는 포함하지 않음)
+static int compact_prefill(const config_t *c, rbtree *t) {
+  if (!c->compact) return 0;
+  uint64_t t0 = now_ns();
+  if (rbtree_compact(t)) {
+    perror("rbtree_compact");
+    return 1;
+  }
+  fprintf(stderr, "compact: %zu keys in %.2f ms\n", rbtree_size(t), (now_ns() - t0) / 1e6);
+  return 0;
+}
+
+static int run_single(const config_t *c, unsigned total_weight) {
+  rbtree_wal *w = NULL;
+  rbtree *t;
+  if (c->wal != NULL) {                             // 이전 실행의 파일은 지우고 빈 tree에서 시작
+    char log[4096];
+    snprintf(log, sizeof(log), "%s.log", c->wal);
+    unlink(c->wal);
+    unlink(log);
+    w = rbtree_wal_open(c->wal, log, c->wal_bytes, c->wal_ms);
+    if (w == NULL) {
+      perror("rbtree_wal_open");
+      return 1;
+    }
+    t = rbtree_wal_tree(w);
+  } else t = new_rbtree();
+  if (t == NULL) return 1;
+  keygen_t g;
+  keygen_init(&g, c);
+  uint64_t rng = c->seed ^ 0x9e3779b97f4a7c15ull;
+
+  size_t count = 0;
+  node_t *last = NULL;                              // -H: 직전에 넣은 노드
+  for (size_t i = 0; i < c->prefill; i++, count++)
+    last = c->hint ? rbtree_insert_hint(t, last, keygen_next(&g)) : rbtree_insert(t, keygen_next(&g));
+  if (w != NULL && rbtree_wal_checkpoint(w)) {     // 미리 넣은 key는 log 없이 snapshot으로 저장하고 빈 log에서 측정
+    perror("rbtree_wal_checkpoint");
+    delete_rbtree_wal(w);
+    return 1;
+  }
+  if (compact_prefill(c, t)) {
+    if (w != NULL) delete_rbtree_wal(w);
+    else delete_rbtree(t);
+    return 1;
+  }
+  if (c->compact) last = NULL;                      // 재배치로 노드 주소가 바뀜
+
+  samples_t s[OP_COUNT];
+  memset(s, 0, sizeof(s));
+  key_t *arr = NULL;
+  size_t arr_cap = 0;
+  rbtree_stats_reset(t);                            // counter는 측정 구간만 셈
+
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < c->ops; i++) {
+    op_t op = pick_op(c, total_weight, &rng);
+    key_t key = keygen_next(&g);
+    if (op == OP_ARRAY && arr_cap < count) {         // 버퍼 준비는 측정에서 제외
+      arr_cap = count * 2;
+      arr = realloc(arr, arr_cap * sizeof(key_t));
+      if (arr == NULL) return 1;
+    }
+    uint64_t t0 = now_ns();
+    switch (op) {
+      case OP_INSERT: {
+        node_t *p = w != NULL ? rbtree_wal_insert(w, key) : c->hint ? rbtree_insert_hint(t, last, key) : rbtree_insert(t, key);
+        if (p != NULL) {
+          count++;
+          last = p;
+        }
+        break;
+      }
+      case OP_FIND:
+        rbtree_find(t, key);
+        break;
+      case OP_ERASE: {
+        node_t *p = rbtree_find(t, key);
+        if (p == last) last = NULL;                 // 반환될 수 있는 노드는 hint로 쓰지 않음
+        if (p != NULL && (w != NULL ? rbtree_wal_erase(w, p) : rbtree_erase(t, p))) count--;
+        break;
+      }
+      case OP_MIN:
+        rbtree_min(t);
+        break;
+      case OP_MAX:
+        rbtree_max(t);
+        break;
+      case OP_ARRAY:
+        if (count > 0) rbtree_to_array(t, arr, count);
+        break;
+      default:
+        break;
+    }
+    samples_add(&s[op], now_ns() - t0);
+  }
+  rbtree_wal_stats_t ws;
+  if (w != NULL) {                                  // 마지막 group commit까지 측정에 포함
+    rbtree_wal_sync(w);
+    rbtree_wal_stats(w, &ws);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  report(c, s, elapsed, t, w != NULL ? &ws : NULL);
+
+  for (int op = 0; op < OP_COUNT; op++) free(s[op].lat);
+  free(arr);
+  if (w != NULL) delete_rbtree_wal(w);
+  else delete_rbtree(t);
+  return 0;
+}
+
+// 같은 key stream을 rbtree_find 반복과 rbtree_find_batch로 조회해 key당 시간을 비교
+// prefill을 LLC보다 크게 잡아야 (예: -p 4000000) prefetch 효과가 드러남
+static int run_batch(const config_t *c) {
+  rbtree *t = new_rbtree();
+  if (t == NULL) return 1;
+  keygen_t g;
+  keygen_init(&g, c);
+  for (size_t i = 0; i < c->prefill; i++) rbtree_insert(t, keygen_next(&g));
+  if (compact_prefill(c, t)) {
+    delete_rbtree(t);
+    return 1;
+  }
+
+  key_t *keys = malloc(c->ops * sizeof(key_t));
+  node_t **out = malloc(c->ops * sizeof(node_t *));
+  if (keys == NULL || out == NULL) {
+    free(keys);
+    free(out);
+    delete_rbtree(t);
+    return 1;
+  }
+  for (size_t i = 0; i < c->ops; i++) keys[i] = keygen_next(&g);
+
+  size_t found_loop = 0;
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < c->ops; i++) {
+    out[i] = rbtree_find(t, keys[i]);
+    found_loop += out[i] != NULL;
+  }
+  uint64_t loop_ns = now_ns() - t0;
+
+  size_t found_batch = 0;
+  t0 = now_ns();
+  for (size_t i = 0; i < c->ops; i += c->batch)
+    found_batch += rbtree_find_batch(t, keys + i, c->ops - i < c->batch ? c->ops - i : c->batch, out + i);
+  uint64_t batch_ns = now_ns() - t0;
+  if (found_loop != found_batch) {
+    fprintf(stderr, "rbtree_find_batch mismatch: %zu != %zu\n", found_batch, found_loop);
+    free(keys);
+    free(out);
+    delete_rbtree(t);
+    return 1;
+  }
+
+  double n = c->ops ? (double)c->ops : 1.0;
+  double speedup = batch_ns ? (double)loop_ns / batch_ns : 0;
+  if (c->fmt == FMT_CSV)
+    printf("dist,layout,prefill,ops,batch,found,loop_ns_per_key,batch_ns_per_key,speedup\n"
+           "%s,%s,%zu,%zu,%zu,%zu,%.1f,%.1f,%.2f\n",
+           dist_names[c->dist], layout, c->prefill, c->ops, c->batch, found_loop, loop_ns / n, batch_ns / n,
+           speedup);
+  else if (c->fmt == FMT_JSON)
+    printf("{\"dist\":\"%s\",\"layout\":\"%s\",\"prefill\":%zu,\"ops\":%zu,\"batch\":%zu,\"found\":%zu,"
+           "\"loop_ns_per_key\":%.1f,\"batch_ns_per_key\":%.1f,\"speedup\":%.2f}\n",
+           dist_names[c->dist], layout, c->prefill, c->ops, c->batch, found_loop, loop_ns / n, batch_ns / n,
+           speedup);
+  else
+    printf("dist=%s layout=%s prefill=%zu ops=%zu batch=%zu found=%zu\n"
+           "rbtree_find       %8.1f ns/key\nrbtree_find_batch %8.1f ns/key (x%.2f)\n",
+           dist_names[c->dist], layout, c->prefill, c->ops, c->batch, found_loop, loop_ns / n, batch_ns / n,
+           speedup);
+
+  free(keys);
+  free(out);
+  delete_rbtree(t);
+  return 0;
+}
+
+typedef struct {
+  const config_t *c;
+  unsigned total_weight;
+  rbtree_mt *m;
+  rbtree_sharded *sh;
+  pthread_barrier_t *start;
+  size_t ops;
+  int id;
+} worker_t;
+
+static void *mt_worker(void *arg) {
+  worker_t *w = (worker_t *)arg;
+  config_t c = *w->c;
+  c.seed = w->c->seed + 7919 * (w->id + 1);         // thread마다 다른 key stream
+  keygen_t g;
+  keygen_init(&g, &c);
+  uint64_t rng = c.seed ^ 0x9e3779b97f4a7c15ull;
+  key_t *arr = NULL, out;
+  size_t arr_cap = 0;
+
+  pthread_barrier_wait(w->start);
+  for (size_t i = 0; i < w->ops; i++) {
+    key_t key = keygen_next(&g);
+    switch (pick_op(&c, w->total_weight, &rng)) {
+      case OP_INSERT:
+        if (w->sh) rbtree_sharded_insert(w->sh, key);
+        else rbtree_mt_insert(w->m, key);
+        break;
+      case OP_FIND:
+        if (w->sh) rbtree_sharded_find(w->sh, key);
+        else rbtree_mt_find(w->m, key);
+        break;
+      case OP_ERASE:
+        if (w->sh) rbtree_sharded_erase(w->sh, key);
+        else rbtree_mt_erase(w->m, key);
+        break;
+      case OP_MIN:
+        if (w->sh) rbtree_sharded_min(w->sh, &out);
+        else rbtree_mt_min(w->m, &out);
+        break;
+      case OP_MAX:
+        if (w->sh) rbtree_sharded_max(w->sh, &out);
+        else rbtree_mt_max(w->m, &out);
+        break;
+      case OP_ARRAY: {
+        size_t n = w->sh ? rbtree_sharded_size(w->sh) : rbtree_mt_size(w->m);
+        if (arr_cap < n) {
+          arr_cap = n * 2;
+          arr = realloc(arr, arr_cap * sizeof(key_t));
+          if (arr == NULL) return NULL;
+        }
+        if (n == 0) break;
+        if (w->sh) rbtree_sharded_to_array(w->sh, arr, n);
+        else rbtree_mt_to_array(w->m, arr, n);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  free(arr);
+  return NULL;
+}
+
+// 공유 tree에서 thread 수를 1, 2, 4, ..., N으로 늘려가며 처리량을 측정
+// shard를 쓰는 경우 미리 넣은 key를 표본으로 경계를 정함
+static int run_mt(const config_t *c, unsigned total_weight) {
+  int counts[64], n_counts = 0;
+  for (int th = 1; th < c->threads; th *= 2) counts[n_counts++] = th;
+  counts[n_counts++] = c->threads;
+
+  double base = 0;
+  if (c->fmt == FMT_CSV) printf("threads,shards,dist,layout,ops,ops_per_sec,speedup\n");
+  else if (c->fmt == FMT_JSON)
+    printf("{\"dist\":\"%s\",\"layout\":\"%s\",\"shards\":%d,\"results\":[", dist_names[c->dist], layout,
+           c->shards);
+  else printf("dist=%s ops=%zu prefill=%zu range=%zu seed=%llu shards=%d\n%-8s %14s %8s\n", dist_names[c->dist],
+              c->ops, c->prefill, c->range, (unsigned long long)c->seed, c->shards, "threads", "ops/sec",
+              "speedup");
+
+  for (int k = 0; k < n_counts; k++) {
+    int th = counts[k];
+    rbtree_mt *m = NULL;
+    rbtree_sharded *sh = NULL;
+    keygen_t g;
+    keygen_init(&g, c);
+    if (c->shards > 0) {
+      key_t *sample = malloc((c->prefill + 1) * sizeof(key_t));
+      if (sample == NULL || (sh = new_rbtree_sharded(c->shards, NULL)) == NULL) return 1;
+      for (size_t i = 0; i < c->prefill; i++) rbtree_sharded_insert(sh, sample[i] = keygen_next(&g));
+      if (c->prefill > 0) rbtree_sharded_rebalance(sh, sample, c->prefill);
+      free(sample);
+    } else {
+      if ((m = new_rbtree_mt()) == NULL) return 1;
+      for (size_t i = 0; i < c->prefill; i++) rbtree_mt_insert(m, keygen_next(&g));
+    }
+
+    pthread_t tid[th];
+    worker_t w[th];
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, th + 1);
+    for (int i = 0; i < th; i++) {
+      w[i] = (worker_t){c, total_weight, m, sh, &start, c->ops / th, i};
+      pthread_create(&tid[i], NULL, mt_worker, &w[i]);
+    }
+    pthread_barrier_wait(&start);
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < th; i++) pthread_join(tid[i], NULL);
+    uint64_t elapsed = now_ns() - t0;
+    pthread_barrier_destroy(&start);
+    delete_rbtree_mt(m);
+    delete_rbtree_sharded(sh);
+
+    size_t done = c->ops / th * th;
+    double ops = done / (elapsed / 1e9);
+    if (k == 0) base = ops;
+    if (c->fmt == FMT_CSV)
+      printf("%d,%d,%s,%s,%zu,%.0f,%.2f\n", th, c->shards, dist_names[c->dist], layout, done, ops, ops / base);
+    else if (c->fmt == FMT_JSON)
+      printf("%s{\"threads\":%d,\"ops\":%zu,\"ops_per_sec\":%.0f,\"speedup\":%.2f}", k ? "," : "", th,
+             done, ops, ops / base);
+    else printf("%-8d %14.0f %8.2f\n", th, ops, ops / base);
+  }
+  if (c->fmt == FMT_JSON) printf("]}\n");
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
+  config_t c;
+  parse_args(&c, argc, argv);
+
+  unsigned total_weight = 0;
+  for (int op = 0; op < OP_COUNT; op++) total_weight += c.weights[op];
+  if (total_weight == 0) usage(argv[0]);
 
-}
\ No newline at end of file
+  if (c.batch > 0) return run_batch(&c);
+  return c.threads > 0 ? run_mt(&c, total_weight) : run_single(&c, total_weight);
+}
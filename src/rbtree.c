@@ -1,73 +1,407 @@
 #include "rbtree.h"
 
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RBTREE_CHUNK_MIN 64
+#define RBTREE_CHUNK_MAX 8192
+#define RBTREE_BATCH_GROUP 16                       // rbtree_find_batch가 동시에 내려가는 key 수
+#define RBTREE_SETOP_GRAIN 4096                     // 집합 연산에서 이보다 작은 부분 문제는 thread로 나누지 않음
+#define RBTREE_EXPORT_GRAIN 65536                   // to_array에서 이보다 작은 서브트리는 thread로 나누지 않음
+#define RBTREE_MAX_HEIGHT 128                       // 높이 <= 2log(n+1)이므로 size_t 범위의 key 수에서 충분
+
+// rbtree_mt의 reader가 lock 없이 따라가는 연결(left/right/key, root/leftmost/rightmost)을 쓰는 store
+// relaxed atomic이라 보통의 store와 같은 명령이 되지만 reader의 atomic load와 data race가 되지 않음
+#define RB_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+// 연산 counter (RBTREE_STATS가 아니면 아무 코드도 만들지 않음)
+// 조회 함수는 const tree를 받으므로 counter만 const를 벗겨 갱신
+// join/split이 임시 tree(sub)에서 센 counter는 RBTREE_COUNT_MERGE로 원래 tree에 더함
+#ifdef RBTREE_STATS
+#define RBTREE_COUNT(t, field, n) (((rbtree *)(t))->counters.field += (n))
+#define RBTREE_COUNT_MERGE(t, sub) rbtree_counters_merge(&(t)->counters, &(sub)->counters)
+#else
+#define RBTREE_COUNT(t, field, n) ((void)0)
+#define RBTREE_COUNT_MERGE(t, sub) ((void)0)
+#endif
+
+#ifdef RBTREE_STATS
+static void rbtree_counters_merge(rbtree_counters_t *dst, const rbtree_counters_t *src) {
+  dst->comparisons += src->comparisons;
+  dst->rotations += src->rotations;
+  dst->insert_fixups += src->insert_fixups;
+  dst->erase_fixups += src->erase_fixups;
+  dst->allocs += src->allocs;
+  dst->frees += src->frees;
+}
+#endif
+
+// interval tree의 max_end 유지 (RBTREE_INTERVAL이 아니면 아무 코드도 만들지 않음)
+#ifdef RBTREE_INTERVAL
+// x의 max_end를 x의 end와 두 자식의 max_end로 다시 계산하는 메서드
+static inline void rbtree_max_end_pull(const rbtree *t, node_t *x) {
+  key_t m = x->end;
+  if (x->left != t->nil && x->left->max_end > m) m = x->left->max_end;
+  if (x->right != t->nil && x->right->max_end > m) m = x->right->max_end;
+  x->max_end = m;
+}
+
+// p와 그 조상들의 max_end를 end 이상으로 올리는 메서드 (이미 end 이상인 노드의 조상은 모두 end 이상)
+static inline void rbtree_max_end_raise(const rbtree *t, node_t *p, const key_t end) {
+  for (; p != t->nil && p->max_end < end; p = rb_parent(p)) p->max_end = end;
+}
+
+// p부터 루트까지 max_end를 다시 계산하는 메서드 (노드가 빠진 뒤 경로를 고침)
+static inline void rbtree_max_end_fix(const rbtree *t, node_t *p) {
+  for (; p != t->nil; p = rb_parent(p)) rbtree_max_end_pull(t, p);
+}
+#else
+#define rbtree_max_end_pull(t, x) ((void)0)
+#define rbtree_max_end_raise(t, p, end) ((void)0)
+#define rbtree_max_end_fix(t, p) ((void)0)
+#endif
+
+// 노드를 한 번에 여러 개 할당하는 slab 단위
+typedef struct node_chunk_t {
+  struct node_chunk_t *next;
+  size_t cap;
+  node_t nodes[];
+} node_chunk_t;
+
+// chunk 목록과 free list
+// split/join으로 노드를 주고받은 tree들은 pool을 공유하고, 마지막 tree가 삭제될 때 chunk를 반환
+typedef struct node_pool_t {
+  node_chunk_t *chunks, *last_chunk;
+  node_t *free_list, *free_tail;                    // 사용 가능한 노드 (right 포인터로 연결)
+  size_t free_count;
+  size_t refs;                                      // 이 pool을 쓰는 tree와 이 pool로 합쳐진 pool의 수
+  struct node_pool_t *forward;                      // 다른 pool로 합쳐졌으면 그 pool
+} node_pool_t;
+
+// 모든 tree가 공유하는 nil 노드 (어떤 연산도 nil에 쓰지 않음)
+#ifdef RBTREE_COMPACT
+static node_t rbtree_nil = {.parent_color = RBTREE_BLACK};
+#else
+static node_t rbtree_nil = {.color = RBTREE_BLACK};
+#endif
 
 void left_rotate(rbtree* t, node_t *x);
 void right_rotate(rbtree* t, node_t *y);
-void rbtree_insert_fixup(rbtree *t, node_t *cur);
+int rbtree_insert_fixup(rbtree *t, node_t *cur);
 void rbtree_transplant(rbtree *t, node_t *u, node_t *v);
-void rbtree_erase_fixup(rbtree *t, node_t *cur);
-void delete_rbtree_node(rbtree *t, node_t *p);
-void rbtree_inorder_traversal(const rbtree *t, node_t *p, key_t *arr, int *idx, size_t n);
+void rbtree_erase_fixup(rbtree *t, node_t *cur, node_t *parent);
+void rbtree_unlink(rbtree *t, node_t *p);
+void rbtree_size_dec(rbtree *t, node_t *p);
+node_t *rbtree_node_alloc(rbtree *t);
+void rbtree_node_free(rbtree *t, node_t *p);
+int rbtree_chunk_alloc(node_pool_t *pool, size_t cap);
+node_chunk_t *rbtree_chunk_new(node_pool_t *pool, size_t cap);
+void rbtree_chunk_release(node_pool_t *pool, node_chunk_t *c);
+node_pool_t *rbtree_pool(rbtree *t);
+void rbtree_pool_release(node_pool_t *pool);
+void rbtree_pool_merge(rbtree *t1, rbtree *t2);
+rbtree *rbtree_new_shared(rbtree *t);
+void rbtree_free_nodes(rbtree *t, node_t *p);
+void rbtree_update_edges(rbtree *t);
+node_t *rbtree_build(rbtree *t, const key_t *arr, const size_t *runs, size_t lo, size_t hi, size_t depth, size_t red_depth);
+void rbtree_size_inc(rbtree *t, node_t *p);
+size_t rbtree_copy_keys(const rbtree *t, const node_t *p, key_t *arr, const size_t n);
+void rbtree_export(const rbtree *t, const node_t *p, key_t *arr, const size_t n, const int depth);
+int rbtree_black_height(const rbtree *t);
+node_t *rbtree_join_node(rbtree *t, node_t *a, int ha, node_t *k, node_t *b, int hb, int *h);
+void rbtree_split_node(rbtree *t, node_t *x, int h, const key_t key, const int incl, node_t **l, int *lh, node_t **r, int *rh);
+void rbtree_split_rank_node(rbtree *t, node_t *x, int h, size_t rank, node_t **l, int *lh, node_t **r, int *rh);
+#ifdef RBTREE_INTERVAL
+int rbtree_overlaps_node(const rbtree *t, node_t *p, const key_t lo, const key_t hi, rbtree_visit_t visit, void *arg, size_t *cnt);
+#endif
+node_t *rbtree_join2(rbtree *t, node_t *a, int ha, node_t *b, int *h);
 
 rbtree *new_rbtree(void) {
   rbtree *p = (rbtree *)calloc(1, sizeof(rbtree));
   if (p == NULL) return NULL;
-  node_t *nil = (node_t *)calloc(1, sizeof(node_t));
-  if (nil != NULL) {
-    nil->color = RBTREE_BLACK;
-    p->nil = nil;
-    p->root = nil;
+  p->pool = (node_pool_t *)calloc(1, sizeof(node_pool_t));
+  if (p->pool == NULL) {
+    free(p);
+    return NULL;
   }
+  p->pool->refs = 1;
+  p->nil = &rbtree_nil;
+  p->root = p->leftmost = p->rightmost = p->nil;
   return p;
 }
 
 void delete_rbtree(rbtree *t) {
   if (t != NULL) {
-    delete_rbtree_node(t, t->root);
-    free(t->nil);
+    rbtree_pool_release(t->pool);                   // 트리를 순회하지 않고 chunk 단위로 반환
     free(t);
     t = NULL;
   }
 }
 
-// 재귀로 BST처럼 노드를 삭제하는 메서드
-void delete_rbtree_node(rbtree *t, node_t *p) {
-  if (p != t->nil) {
-    delete_rbtree_node(t, p->left);
-    delete_rbtree_node(t, p->right);
-    free(p);
-    p = NULL;
+// t와 pool을 공유하는 빈 tree를 만드는 메서드
+rbtree *rbtree_new_shared(rbtree *t) {
+  rbtree *p = (rbtree *)calloc(1, sizeof(rbtree));
+  if (p == NULL) return NULL;
+  p->pool = rbtree_pool(t);
+  p->pool->refs++;
+  p->nil = &rbtree_nil;
+  p->root = p->leftmost = p->rightmost = p->nil;
+  return p;
+}
+
+// tree가 쓰는 pool을 반환하는 메서드 (합쳐진 pool을 따라가며 참조를 옮김)
+node_pool_t *rbtree_pool(rbtree *t) {
+  while (t->pool->forward != NULL) {
+    node_pool_t *old = t->pool;
+    t->pool = old->forward;
+    t->pool->refs++;
+    rbtree_pool_release(old);
+  }
+  return t->pool;
+}
+
+// pool의 참조를 하나 줄이고, 더 이상 쓰는 tree가 없으면 chunk와 함께 반환하는 메서드
+void rbtree_pool_release(node_pool_t *pool) {
+  while (pool != NULL && --pool->refs == 0) {
+    node_pool_t *next = pool->forward;              // 합쳐진 pool은 chunk가 없고 next의 참조 하나를 가짐
+    node_chunk_t *c = pool->chunks;
+    while (c != NULL) {
+      node_chunk_t *tmp = c->next;
+      free(c);
+      c = tmp;
+    }
+    free(pool);
+    pool = next;
+  }
+}
+
+// cap개의 노드를 가진 chunk를 새로 할당해 free list에 연결하는 메서드
+int rbtree_chunk_alloc(node_pool_t *pool, size_t cap) {
+  node_chunk_t *c = rbtree_chunk_new(pool, cap);
+  if (c == NULL) return 1;
+  rbtree_chunk_release(pool, c);
+  return 0;
+}
+
+// cap개의 노드를 가진 chunk를 새로 할당해 chunk 목록에만 붙이는 메서드 (노드는 free list에 넣지 않음)
+node_chunk_t *rbtree_chunk_new(node_pool_t *pool, size_t cap) {
+  node_chunk_t *c = (node_chunk_t *)malloc(sizeof(node_chunk_t) + cap * sizeof(node_t));
+  if (c == NULL) return NULL;
+  c->cap = cap;
+  c->next = pool->chunks;
+  if (pool->chunks == NULL) pool->last_chunk = c;
+  pool->chunks = c;
+  return c;
+}
+
+// chunk의 모든 노드를 free list에 연결하는 메서드
+void rbtree_chunk_release(node_pool_t *pool, node_chunk_t *c) {
+  if (pool->free_list == NULL) pool->free_tail = &c->nodes[c->cap - 1];
+  for (size_t i = c->cap; i > 0; i--) {             // 주소 순서대로 꺼내지도록 뒤에서부터 연결
+    RB_STORE(c->nodes[i - 1].right, pool->free_list);
+    pool->free_list = &c->nodes[i - 1];
+  }
+  pool->free_count += c->cap;
+}
+
+// free list에서 노드 하나를 꺼내는 메서드 (비어 있으면 chunk를 새로 할당)
+node_t *rbtree_node_alloc(rbtree *t) {
+  node_pool_t *pool = rbtree_pool(t);
+  if (pool->free_list == NULL) {
+    size_t cap = pool->chunks == NULL ? RBTREE_CHUNK_MIN : pool->chunks->cap * 2;
+    if (cap > RBTREE_CHUNK_MAX) cap = RBTREE_CHUNK_MAX;
+    if (cap < RBTREE_CHUNK_MIN) cap = RBTREE_CHUNK_MIN;
+    if (rbtree_chunk_alloc(pool, cap)) return NULL;
+  }
+  node_t *p = pool->free_list;
+  pool->free_list = p->right;
+  if (pool->free_list == NULL) pool->free_tail = NULL;
+  pool->free_count--;
+  RBTREE_COUNT(t, allocs, 1);
+  return p;
+}
+
+// 노드를 free list로 되돌리는 메서드 (chunk는 delete_rbtree에서 반환)
+void rbtree_node_free(rbtree *t, node_t *p) {
+  node_pool_t *pool = rbtree_pool(t);
+  if (pool->free_list == NULL) pool->free_tail = p;
+  RB_STORE(p->right, pool->free_list);
+  pool->free_list = p;
+  pool->free_count++;
+  RBTREE_COUNT(t, frees, 1);
+}
+
+// tree가 차지하는 전체 메모리(byte)를 반환 (할당된 chunk 포함, 공유하는 pool은 전체를 셈)
+size_t rbtree_memory(const rbtree *t) {
+  if (t == NULL) return 0;
+  const node_pool_t *pool = t->pool;
+  while (pool->forward != NULL) pool = pool->forward;
+  size_t bytes = sizeof(rbtree) + sizeof(node_pool_t);  // tree 구조체와 pool
+  for (const node_chunk_t *c = pool->chunks; c != NULL; c = c->next)
+    bytes += sizeof(node_chunk_t) + c->cap * sizeof(node_t);
+  return bytes;
+}
+
+// 앞으로 n개의 노드를 추가 할당 없이 삽입할 수 있도록 미리 확보하는 메서드
+int rbtree_reserve(rbtree *t, const size_t n) {
+  if (t == NULL) return 1;
+  node_pool_t *pool = rbtree_pool(t);
+  if (pool->free_count >= n) return 0;
+  return rbtree_chunk_alloc(pool, n - pool->free_count);
+}
+
+rbtree *rbtree_from_sorted(const key_t *arr, const size_t n) {
+  if (arr == NULL && n > 0) return NULL;
+  rbtree *t = new_rbtree();
+  if (t == NULL) return NULL;
+  if (rbtree_assign_sorted(t, arr, n)) {            // 새 tree이므로 노드 n개가 한 chunk에 연속으로 할당됨
+    delete_rbtree(t);
+    return NULL;
+  }
+  return t;
+}
+
+// 모든 노드를 free list로 되돌려 tree를 비우는 메서드 (chunk는 유지)
+void rbtree_clear(rbtree *t) {
+  if (t == NULL) return;
+  node_pool_t *pool = rbtree_pool(t);
+  if (pool->refs > 1) rbtree_free_nodes(t, t->root);  // 다른 tree의 노드도 있는 pool이면 하나씩 반환
+  else {
+    pool->free_list = pool->free_tail = NULL;
+    pool->free_count = 0;
+    for (node_chunk_t *c = pool->chunks; c != NULL; c = c->next) rbtree_chunk_release(pool, c);
+  }
+  RB_STORE(t->root, t->nil);
+  RB_STORE(t->leftmost, t->nil);
+  RB_STORE(t->rightmost, t->nil);
+}
+
+// root가 바뀐 뒤 최솟값, 최댓값 노드를 다시 찾는 메서드 (O(log n))
+void rbtree_update_edges(rbtree *t) {
+  node_t *p = t->root;
+  while (p != t->nil && p->left != t->nil) p = p->left;
+  RB_STORE(t->leftmost, p);
+  p = t->root;
+  while (p != t->nil && p->right != t->nil) p = p->right;
+  RB_STORE(t->rightmost, p);
+}
+
+// p를 루트로 하는 서브트리의 노드를 free list로 되돌리는 메서드
+void rbtree_free_nodes(rbtree *t, node_t *p) {
+  while (p != t->nil) {
+    rbtree_free_nodes(t, p->left);
+    node_t *right = p->right;
+    rbtree_node_free(t, p);
+    p = right;
   }
 }
 
+// tree의 내용을 정렬된 arr로 교체하는 메서드 (기존 노드를 재사용)
+int rbtree_assign_sorted(rbtree *t, const key_t *arr, const size_t n) {
+  if (t == NULL || (arr == NULL && n > 0)) return 1;
+  size_t m = n;                                     // 만들 노드 수
+  size_t *runs = NULL;
+#ifdef RBTREE_COUNTED
+  runs = (size_t *)malloc((n + 1) * sizeof(size_t));  // 같은 key가 시작하는 위치 (key마다 노드 하나)
+  if (runs == NULL) return 1;
+  m = 0;
+  for (size_t i = 0; i < n; i++)
+    if (i == 0 || arr[i] != arr[i - 1]) runs[m++] = i;
+  runs[m] = n;
+#endif
+  rbtree_clear(t);
+  if (m > 0 && rbtree_reserve(t, m)) {
+    free(runs);
+    return 1;
+  }
+  size_t max_depth = 0;                             // 가장 깊은 레벨의 노드만 RED로 칠함
+  while (((size_t)2 << max_depth) - 1 < m) max_depth++;
+  RB_STORE(t->root, rbtree_build(t, arr, runs, 0, m, 0, max_depth == 0 ? (size_t)-1 : max_depth));
+  if (t->root != t->nil) rb_set_parent(t->root, t->nil);
+  rbtree_update_edges(t);
+  free(runs);
+  return 0;
+}
+
+// [lo, hi) 번째 노드로 균형 잡힌 서브트리를 만드는 메서드 (노드는 중위 순서대로 할당)
+// runs가 있으면 i번째 노드는 arr[runs[i], runs[i + 1]) 구간의 같은 key들을 나타냄
+node_t *rbtree_build(rbtree *t, const key_t *arr, const size_t *runs, size_t lo, size_t hi, size_t depth, size_t red_depth) {
+  if (lo >= hi) return t->nil;
+  size_t mid = lo + (hi - lo) / 2;
+  node_t *left = rbtree_build(t, arr, runs, lo, mid, depth + 1, red_depth);
+  node_t *p = rbtree_node_alloc(t);                 // reserve 했으므로 실패하지 않음
+  RB_STORE(p->key, runs == NULL ? arr[mid] : arr[runs[mid]]);
+#ifdef RBTREE_COUNTED
+  p->count = runs[mid + 1] - runs[mid];
+#endif
+#ifdef RBTREE_INTERVAL
+  p->end = p->key;
+#endif
+  rb_set_color(p, depth == red_depth ? RBTREE_RED : RBTREE_BLACK);
+  RB_STORE(p->left, left);
+  if (left != t->nil) rb_set_parent(left, p);
+  RB_STORE(p->right, rbtree_build(t, arr, runs, mid + 1, hi, depth + 1, red_depth));
+  if (p->right != t->nil) rb_set_parent(p->right, p);
+  p->size = left->size + p->right->size + rb_count(p);
+  rbtree_max_end_pull(t, p);
+  return p;
+}
+
+static int rbtree_key_cmp(const void *a, const void *b) {
+  const key_t x = *(const key_t *)a, y = *(const key_t *)b;
+  return (x > y) - (x < y);
+}
+
+rbtree *rbtree_from_array(const key_t *arr, const size_t n) {
+  if (arr == NULL && n > 0) return NULL;
+  key_t *sorted = (key_t *)malloc((n ? n : 1) * sizeof(key_t));
+  if (sorted == NULL) return NULL;
+  for (size_t i = 0; i < n; i++) sorted[i] = arr[i];
+  qsort(sorted, n, sizeof(key_t), rbtree_key_cmp);
+  rbtree *t = rbtree_from_sorted(sorted, n);
+  free(sorted);
+  return t;
+}
+
 // x를 기준으로 왼쪽으로 회전하는 메서드
 void left_rotate(rbtree *t, node_t *x) {
   if (t != NULL) {
+    RBTREE_COUNT(t, rotations, 1);
     node_t *y = x->right;
-    x->right = y->left;
-    if (y->left != t->nil) y->left->parent = x;
-    y->parent = x->parent;
-    if (x->parent == t->nil) t->root = y;
-    else if (x == x->parent->left) x->parent->left = y;
-    else x->parent->right = y;
-    y->left = x;
-    x->parent = y;
+    RB_STORE(x->right, y->left);
+    if (y->left != t->nil) rb_set_parent(y->left, x);
+    rb_set_parent(y, rb_parent(x));
+    if (rb_parent(x) == t->nil) RB_STORE(t->root, y);
+    else if (x == rb_parent(x)->left) RB_STORE(rb_parent(x)->left, y);
+    else RB_STORE(rb_parent(x)->right, y);
+    RB_STORE(y->left, x);
+    rb_set_parent(x, y);
+    y->size = x->size;                              // y가 x의 서브트리를 그대로 물려받음
+    x->size = x->left->size + x->right->size + rb_count(x);
+    rbtree_max_end_pull(t, x);                      // 아래로 내려간 x부터
+    rbtree_max_end_pull(t, y);
   }
 }
 
 // y를 기준으로 오른쪽으로 회전하는 메서드
 void right_rotate(rbtree *t, node_t *y) {
   if (t != NULL) {
+    RBTREE_COUNT(t, rotations, 1);
     node_t *x = y->left;
-    y->left = x->right;
-    if (x->right != t->nil) x->right->parent = y;
-    x->parent = y->parent;
-    if (y->parent == t->nil) t->root = x;
-    else if (y == y->parent->right) y->parent->right = x;
-    else y->parent->left = x;
-    x->right = y;
-    y->parent = x;
+    RB_STORE(y->left, x->right);
+    if (x->right != t->nil) rb_set_parent(x->right, y);
+    rb_set_parent(x, rb_parent(y));
+    if (rb_parent(y) == t->nil) RB_STORE(t->root, x);
+    else if (y == rb_parent(y)->right) RB_STORE(rb_parent(y)->right, x);
+    else RB_STORE(rb_parent(y)->left, x);
+    RB_STORE(x->right, y);
+    rb_set_parent(y, x);
+    x->size = y->size;                              // x가 y의 서브트리를 그대로 물려받음
+    y->size = y->left->size + y->right->size + rb_count(y);
+    rbtree_max_end_pull(t, y);
+    rbtree_max_end_pull(t, x);
   }
 }
 
@@ -75,89 +409,195 @@ node_t *rbtree_insert(rbtree *t, const key_t key) {
   if (t == NULL) return NULL;
   node_t *cur = t->root;
   node_t *prev = t->nil;
-  node_t *new_node = (node_t *)calloc(1, sizeof(node_t));
-  if (new_node != NULL) {
-    new_node->color = RBTREE_RED;
-    new_node->key = key;
-    new_node->left = t->nil;
-    new_node->right = t->nil;
-    new_node->parent = t->nil;
-
-    while (cur != t->nil) {
-      prev = cur;
-      if (new_node->key < cur->key) cur = cur->left;
-      else cur = cur->right;
+  int leftmost = 1, rightmost = 1;                  // 한쪽으로만 내려가면 새 최솟값(최댓값)
+  while (cur != t->nil) {
+    RBTREE_COUNT(t, comparisons, 1);
+    cur->size++;                                    // 새 key는 지나가는 모든 노드의 서브트리에 들어감
+#ifdef RBTREE_COUNTED
+    if (key == cur->key) {                          // 같은 key가 있으면 개수만 늘림
+      cur->count++;
+      return cur;
     }
+#endif
+    prev = cur;
+    if (key < cur->key) {
+      cur = cur->left;
+      rightmost = 0;
+    } else {
+      cur = cur->right;
+      leftmost = 0;
+    }
+  }
+  node_t *new_node = rbtree_node_alloc(t);
+  if (new_node == NULL) {
+    for (cur = prev; cur != t->nil; cur = rb_parent(cur)) cur->size--;  // 늘려 둔 서브트리 크기를 되돌림
+    return NULL;
+  }
+  rb_set_color(new_node, RBTREE_RED);
+  RB_STORE(new_node->key, key);
+  RB_STORE(new_node->left, t->nil);
+  RB_STORE(new_node->right, t->nil);
+  new_node->size = 1;
+#ifdef RBTREE_COUNTED
+  new_node->count = 1;
+#endif
+#ifdef RBTREE_INTERVAL
+  new_node->end = new_node->max_end = key;
+#endif
+  if (leftmost) RB_STORE(t->leftmost, new_node);
+  if (rightmost) RB_STORE(t->rightmost, new_node);
 
-    new_node->parent = prev;
-    if (prev == t->nil) t->root = new_node;
-    else if (new_node->key < prev->key) prev->left = new_node;
-    else prev->right = new_node;
+  rb_set_parent(new_node, prev);
+  if (prev == t->nil) RB_STORE(t->root, new_node);
+  else if (key < prev->key) RB_STORE(prev->left, new_node);
+  else RB_STORE(prev->right, new_node);
+  rbtree_max_end_raise(t, prev, key);
 
-    rbtree_insert_fixup(t, new_node);
-    return new_node;
-  } else return NULL;
+  rbtree_insert_fixup(t, new_node);
+  return new_node;
+}
+
+#ifdef RBTREE_INTERVAL
+// 구간 [lo, hi]를 lo를 key로 삽입하는 메서드 (점 구간으로 넣은 뒤 end를 늘리고 조상의 max_end를 올림)
+node_t *rbtree_insert_interval(rbtree *t, const key_t lo, const key_t hi) {
+  if (t == NULL || hi < lo) return NULL;
+  node_t *p = rbtree_insert(t, lo);
+  if (p != NULL) {
+    p->end = hi;
+    rbtree_max_end_raise(t, p, hi);
+  }
+  return p;
+}
+#endif
+
+// hint 노드 근처에서 자리를 찾아 key를 삽입하는 메서드 (hint가 NULL이면 rbtree_insert와 같음)
+// hint에서 key를 포함하는 서브트리까지만 올라간 뒤 내려가므로, 직전에 넣은 노드를 hint로 주면
+// 정렬되었거나 거의 정렬된 입력의 탐색 비용이 상수에 가까움 (서브트리 크기 갱신은 루트까지 이어짐)
+node_t *rbtree_insert_hint(rbtree *t, node_t *hint, const key_t key) {
+  if (t == NULL) return NULL;
+  if (hint == NULL || hint == t->nil || t->root == t->nil) return rbtree_insert(t, key);
+  node_t *cur = hint;
+  if (key < hint->key) {
+    while (cur != t->leftmost) {                    // 왼쪽 끝이면 하한이 없음
+      node_t *x = cur;
+      while (rb_parent(x) != t->nil && x == rb_parent(x)->left) x = rb_parent(x);
+      node_t *lo = rb_parent(x);                    // cur 서브트리의 하한 (cur가 오른쪽 서브트리에 있는 가장 가까운 조상)
+      if (lo == t->nil || lo->key < key) break;     // key는 cur의 서브트리 안에 들어감
+      cur = lo;
+    }
+  } else {
+    while (cur != t->rightmost) {                   // 오른쪽 끝이면 상한이 없음
+      node_t *x = cur;
+      while (rb_parent(x) != t->nil && x == rb_parent(x)->right) x = rb_parent(x);
+      node_t *hi = rb_parent(x);                    // cur 서브트리의 상한
+      if (hi == t->nil || key < hi->key) break;
+      cur = hi;
+    }
+  }
+  node_t *prev = t->nil;
+  while (cur != t->nil) {
+#ifdef RBTREE_COUNTED
+    if (cur->key == key) {                          // 같은 key가 있으면 개수만 늘림
+      cur->count++;
+      rbtree_size_inc(t, cur);
+      return cur;
+    }
+#endif
+    RBTREE_COUNT(t, comparisons, 1);
+    prev = cur;
+    cur = key < cur->key ? cur->left : cur->right;
+  }
+  node_t *new_node = rbtree_node_alloc(t);
+  if (new_node == NULL) return NULL;
+  rb_set_color(new_node, RBTREE_RED);
+  RB_STORE(new_node->key, key);
+  RB_STORE(new_node->left, t->nil);
+  RB_STORE(new_node->right, t->nil);
+  new_node->size = 0;
+#ifdef RBTREE_COUNTED
+  new_node->count = 1;
+#endif
+#ifdef RBTREE_INTERVAL
+  new_node->end = new_node->max_end = key;
+#endif
+  rb_set_parent(new_node, prev);
+  if (key < prev->key) {
+    RB_STORE(prev->left, new_node);
+    if (prev == t->leftmost) RB_STORE(t->leftmost, new_node);
+  } else {
+    RB_STORE(prev->right, new_node);
+    if (prev == t->rightmost) RB_STORE(t->rightmost, new_node);
+  }
+  rbtree_size_inc(t, new_node);                     // 새 노드와 그 조상들의 크기를 늘림
+  rbtree_max_end_raise(t, prev, key);
+  rbtree_insert_fixup(t, new_node);
+  return new_node;
 }
 
 // 삽입 시 RB트리 속성을 위반했다면 재조정하는 메서드
-void rbtree_insert_fixup(rbtree *t, node_t *cur) {
+// 루트가 RED가 되었다가 BLACK으로 바뀌어 black height가 1 늘었으면 1을 반환
+int rbtree_insert_fixup(rbtree *t, node_t *cur) {
   node_t *uncle = t->nil;
-  while (cur->parent->color == RBTREE_RED) {
-    if (cur->parent == cur->parent->parent->left) { // 부모가 할아버지의 왼쪽 자식일 때
-      uncle = cur->parent->parent->right;           // 삼촌은 할아버지의 오른쪽 자식
+  while (rb_color(rb_parent(cur)) == RBTREE_RED) {
+    RBTREE_COUNT(t, insert_fixups, 1);
+    if (rb_parent(cur) == rb_parent(rb_parent(cur))->left) { // 부모가 할아버지의 왼쪽 자식일 때
+      uncle = rb_parent(rb_parent(cur))->right;     // 삼촌은 할아버지의 오른쪽 자식
       // Case 1: 부모도 RED, 삼촌도 RED
       // → 부모와 삼촌을 BLACK으로 바꾸고 할아버지를 RED로 바꾼 후 할아버지에서 다시 확인
-      if (uncle->color == RBTREE_RED) {
-        cur->parent->color = RBTREE_BLACK;          // 부모를 BLACK으로
-        uncle->color = RBTREE_BLACK;                // 삼촌을 BLACK으로
-        cur->parent->parent->color = RBTREE_RED;    // 할아버지를 RED로
-        cur = cur->parent->parent;                  // 할아버지에서 다시 확인
+      if (rb_color(uncle) == RBTREE_RED) {
+        rb_set_color(rb_parent(cur), RBTREE_BLACK); // 부모를 BLACK으로
+        rb_set_color(uncle, RBTREE_BLACK);          // 삼촌을 BLACK으로
+        rb_set_color(rb_parent(rb_parent(cur)), RBTREE_RED); // 할아버지를 RED로
+        cur = rb_parent(rb_parent(cur));            // 할아버지에서 다시 확인
       } else {
         // Case 2-1: 삽입된 노드가 부모의 오른쪽 자녀, 부모가 RED이고 할아버지의 왼쪽 자녀, 삼촌은 BLACK
         // → 부모를 기준으로 왼쪽으로 회전한 후 Case 3 방식으로 해결
-        if (cur == cur->parent->right) {
-          cur = cur->parent;                        // 부모를 기준으로
+        if (cur == rb_parent(cur)->right) {
+          cur = rb_parent(cur);                     // 부모를 기준으로
           left_rotate(t, cur);                      // 왼쪽으로 회전
         }
         // Case 3-1: 삽입된 노드가 부모의 왼쪽 자녀, 부모가 RED이고 할아버지의 왼쪽 자녀, 삼촌은 BLACK
         // → 부모와 할아버지의 색을 바꾼 후 할아버지 기준으로 오른쪽으로 회전
-        color_t tmp = cur->parent->color;
-        cur->parent->color = cur->parent->parent->color; // 부모의 색을 할아버지의 색으로
-        cur->parent->parent->color = tmp;           // 할아버지의 색을 부모의 색으로
-        right_rotate(t, cur->parent->parent);       // 할아버지를 기준으로 오른쪽으로 회전
+        color_t tmp = rb_color(rb_parent(cur));
+        rb_set_color(rb_parent(cur), rb_color(rb_parent(rb_parent(cur)))); // 부모의 색을 할아버지의 색으로
+        rb_set_color(rb_parent(rb_parent(cur)), tmp); // 할아버지의 색을 부모의 색으로
+        right_rotate(t, rb_parent(rb_parent(cur))); // 할아버지를 기준으로 오른쪽으로 회전
       }
     } else {                                        // 부모가 할아버지의 오른쪽 자식일 때
-      uncle = cur->parent->parent->left;            // 삼촌은 할아버지의 오른쪽 자식
+      uncle = rb_parent(rb_parent(cur))->left;      // 삼촌은 할아버지의 오른쪽 자식
       // Case 1: 부모도 RED, 삼촌도 RED
       // → 부모와 삼촌을 BLACK으로 바꾸고 할아버지를 RED로 바꾼 후 할아버지에서 다시 확인
-      if (uncle->color == RBTREE_RED) {
-        cur->parent->color = RBTREE_BLACK;          // 부모를 BLACK으로
-        uncle->color = RBTREE_BLACK;                // 삼촌을 BLACK으로
-        cur->parent->parent->color = RBTREE_RED;    // 할아버지를 RED로
-        cur = cur->parent->parent;                  // 할아버지에서 다시 확인
+      if (rb_color(uncle) == RBTREE_RED) {
+        rb_set_color(rb_parent(cur), RBTREE_BLACK); // 부모를 BLACK으로
+        rb_set_color(uncle, RBTREE_BLACK);          // 삼촌을 BLACK으로
+        rb_set_color(rb_parent(rb_parent(cur)), RBTREE_RED); // 할아버지를 RED로
+        cur = rb_parent(rb_parent(cur));            // 할아버지에서 다시 확인
       } else {
         // Case 2-2: 삽입된 노드가 부모의 왼쪽 자녀, 부모가 RED이고 할아버지의 오른쪽 자녀, 삼촌은 BLACK
         // → 부모를 기준으로 오른쪽으로 회전한 뒤 Case 3의 방식으로 해결
-        if (cur == cur->parent->left) {
-          cur = cur->parent;                        // 부모를 기준으로
+        if (cur == rb_parent(cur)->left) {
+          cur = rb_parent(cur);                     // 부모를 기준으로
           right_rotate(t, cur);                     // 오른쪽으로 회전
         }
         // Case 3-2: 삽입된 노드가 부모의 오른쪽 자녀, 부모가 RED이고 할아버지의 오른쪽 자녀, 삼촌은 BLACK
         // → 부모와 할아버지의 색을 바꾼 후 할아버지 기준으로 왼쪽으로 회전
-        color_t tmp = cur->parent->color;
-        cur->parent->color = cur->parent->parent->color; // 부모의 색을 할아버지의 색으로
-        cur->parent->parent->color = tmp;           // 할아버지의 색을 부모의 색으로
-        left_rotate(t, cur->parent->parent);        // 할아버지를 기준으로 왼쪽으로 회전
+        color_t tmp = rb_color(rb_parent(cur));
+        rb_set_color(rb_parent(cur), rb_color(rb_parent(rb_parent(cur)))); // 부모의 색을 할아버지의 색으로
+        rb_set_color(rb_parent(rb_parent(cur)), tmp); // 할아버지의 색을 부모의 색으로
+        left_rotate(t, rb_parent(rb_parent(cur)));  // 할아버지를 기준으로 왼쪽으로 회전
       }
     }
   }
-  t->root->color = RBTREE_BLACK;                    // 루트를 BLACK으로
+  int grew = rb_color(t->root) == RBTREE_RED;
+  rb_set_color(t->root, RBTREE_BLACK);              // 루트를 BLACK으로
+  return grew;
 }
 
 node_t *rbtree_find(const rbtree *t, const key_t key) {
   if (t == NULL || t->root == t->nil) return NULL;
   node_t *cur = t->root;
   while (cur != t->nil) {
+    RBTREE_COUNT(t, comparisons, 1);
     if (cur->key > key) cur = cur->left;
     else if (cur->key < key) cur = cur->right;
     else return cur;
@@ -165,36 +605,95 @@ node_t *rbtree_find(const rbtree *t, const key_t key) {
   return NULL;
 }
 
+// keys[i]를 가진 노드(없으면 NULL)를 out[i]에 저장하고 찾은 key 수를 반환
+// key 여러 개의 탐색을 한 level씩 번갈아 진행하며 다음 노드를 prefetch해서 cache miss를 겹침
+size_t rbtree_find_batch(const rbtree *t, const key_t *keys, const size_t n, node_t **out) {
+  if (t == NULL || (n > 0 && (keys == NULL || out == NULL))) return 0;
+  size_t found = 0;
+  node_t *cur[RBTREE_BATCH_GROUP];
+  size_t idx[RBTREE_BATCH_GROUP];                   // 아직 탐색 중인 key의 위치
+  for (size_t base = 0; base < n; base += RBTREE_BATCH_GROUP) {
+    size_t active = n - base < RBTREE_BATCH_GROUP ? n - base : RBTREE_BATCH_GROUP;
+    for (size_t i = 0; i < active; i++) {
+      cur[i] = t->root;
+      idx[i] = base + i;
+      out[base + i] = NULL;
+    }
+    while (active > 0) {
+      size_t next = 0;
+      for (size_t i = 0; i < active; i++) {
+        node_t *p = cur[i];
+        if (p == t->nil) continue;                  // 없는 key
+        key_t key = keys[idx[i]];
+        RBTREE_COUNT(t, comparisons, 1);
+        if (p->key > key) p = p->left;
+        else if (p->key < key) p = p->right;
+        else {
+          out[idx[i]] = p;
+          found++;
+          continue;
+        }
+        __builtin_prefetch(p);                      // 다른 key를 한 level씩 진행하는 동안 읽어 옴
+        cur[next] = p;
+        idx[next++] = idx[i];
+      }
+      active = next;
+    }
+  }
+  return found;
+}
+
 node_t *rbtree_min(const rbtree *t) {
   if (t == NULL) return NULL;
-  if (t->root == t->nil) return t->nil; 
-  node_t *cur = t->root;
-  while (cur->left != t->nil) cur = cur->left;
-  return cur;
+  return t->leftmost;                               // 비어 있으면 nil
 }
 
 node_t *rbtree_max(const rbtree *t) {
   if (t == NULL) return NULL;
-  if (t->root == t->nil) return t->nil; 
-  node_t *cur = t->root;
-  while (cur->right != t->nil) cur = cur->right;
-  return cur;
+  return t->rightmost;
 }
 
 // u를 v로 바꾸는 메서드
 void rbtree_transplant(rbtree *t, node_t *u, node_t *v) {
   if (t == NULL) return;
-  if (u->parent == t->nil) t->root = v;
-  else if (u == u->parent->left) u->parent->left = v;
-  else u->parent->right = v;
-  v->parent = u->parent;
+  if (rb_parent(u) == t->nil) RB_STORE(t->root, v);
+  else if (u == rb_parent(u)->left) RB_STORE(rb_parent(u)->left, v);
+  else RB_STORE(rb_parent(u)->right, v);
+  if (v != t->nil) rb_set_parent(v, rb_parent(u));  // nil은 공유하므로 parent를 기록하지 않음
 }
 
 int rbtree_erase(rbtree *t, node_t *p) {
   if (t == NULL || t->root == t->nil) return 0;
+#ifdef RBTREE_COUNTED
+  if (p->count > 1) {                               // 같은 key가 더 남아 있으면 개수만 줄임
+    p->count--;
+    rbtree_size_dec(t, p);
+    p->size--;
+    return 1;
+  }
+#endif
+  rbtree_unlink(t, p);
+  rbtree_node_free(t, p);
+  p = NULL;
+  return 1;
+}
+
+// p를 tree에서 떼어내는 메서드 (노드는 반환하지 않음)
+void rbtree_unlink(rbtree *t, node_t *p) {
+  if (p == t->leftmost) {                           // 떼어내기 전에 다음 최솟값(최댓값)을 찾아 둠
+    node_t *next = rbtree_next(t, p);
+    RB_STORE(t->leftmost, next == NULL ? t->nil : next);
+  }
+  if (p == t->rightmost) {
+    node_t *prev = rbtree_prev(t, p);
+    RB_STORE(t->rightmost, prev == NULL ? t->nil : prev);
+  }
   node_t *x = t->nil;                               // x는 y의 원래 자리로 이동하는 노드
+  node_t *xp = rb_parent(p);                        // x의 부모 (x가 nil일 수 있으므로 따로 기억)
   node_t *y = p;                                    // y는 p의 자리로 이동하는 노드
-  color_t y_original_color = y->color;              // p의 자식이 하나 이하면 삭제되는 색은 p의 색
+  color_t y_original_color = rb_color(y);           // p의 자식이 하나 이하면 삭제되는 색은 p의 색
+  for (node_t *cur = rb_parent(p); cur != t->nil; cur = rb_parent(cur))
+    cur->size -= rb_count(p);                       // p 위쪽은 p만큼 줄어듦
   // 1. 삭제하려는 노드의 자녀가 없거나 하나라면, 삭제되는 색 = 삭제되는 노드의 색
   if (p->left == t->nil) {
     // 1-1. 삭제 노드의 왼쪽 자식이 NIL일 때
@@ -210,122 +709,1078 @@ int rbtree_erase(rbtree *t, node_t *p) {
     // 2. 삭제하려는 노드의 자녀가 둘이라면, 삭제되는 색 = 삭제되는 노드의 후임자의 색
     y = p->right;
     while (y->left != t->nil) y = y->left;          // y는 p의 후임자
-    y_original_color = y->color;                    // 삭제되는 색은 후임자의 색
+    y_original_color = rb_color(y);                 // 삭제되는 색은 후임자의 색
+    for (node_t *cur = rb_parent(y); cur != p; cur = rb_parent(cur))
+      cur->size -= rb_count(y);                     // 후임자가 빠져나가는 경로
     x = y->right;
     if (y != p->right) {                            // 후임자가 p의 자식이 아닌 경우
       // 2-1. 삭제 노드의 후임자가 손자 이하일 때
       // → 삭제 노드를 후임자로, 후임자를 그 오른쪽 자식으로 대체함
+      xp = rb_parent(y);
       rbtree_transplant(t, y, y->right);
-      y->right = p->right;
-      y->right->parent = y;
+      RB_STORE(y->right, p->right);
+      rb_set_parent(y->right, y);
     } else {
       // 2-2. 삭제 노드의 오른쪽 자식이 후임자일 때
       // → 삭제 노드를 오른쪽 자식으로, 오른쪽 자식을 오른쪽 손자로 대체함
-      x->parent = y;                                // x가 NIL인 경우 (?)
+      xp = y;                                       // x는 y의 오른쪽 자식으로 남음
     }
     rbtree_transplant(t, p, y);                     // p를 후임자로 대체함
-    y->left = p->left;                              // p의 왼쪽 자식을 y에 연결
-    y->left->parent = y;                            // p의 왼쪽 자식에 y를 연결
-    y->color = p->color;                            // 후임자를 p의 색으로
+    RB_STORE(y->left, p->left);                     // p의 왼쪽 자식을 y에 연결
+    rb_set_parent(y->left, y);                      // p의 왼쪽 자식에 y를 연결
+    rb_set_color(y, rb_color(p));                   // 후임자를 p의 색으로
+    y->size = p->size - rb_count(p);                // 후임자를 p가 빠진 크기로
   }
+  rbtree_max_end_fix(t, xp);                        // xp는 구조가 바뀐 가장 낮은 노드 (y가 옮겨 갔으면 y도 그 위에 있음)
   if (y_original_color == RBTREE_BLACK)             // 삭제 노드의 색이 BLACK이라면
-    rbtree_erase_fixup(t, x);                       // → 재조정 수행
-  free(p);
-  p = NULL;
-  return 1;
+    rbtree_erase_fixup(t, x, xp);                   // → 재조정 수행
+}
+
+// p가 빠지는 자리의 조상들의 서브트리 크기를 하나씩 줄이는 메서드
+void rbtree_size_dec(rbtree *t, node_t *p) {
+  for (node_t *cur = rb_parent(p); cur != t->nil; cur = rb_parent(cur)) cur->size--;
+}
+
+// p와 그 조상들의 서브트리 크기를 하나씩 늘리는 메서드
+void rbtree_size_inc(rbtree *t, node_t *p) {
+  for (node_t *cur = p; cur != t->nil; cur = rb_parent(cur)) cur->size++;
 }
 
 // 삭제 시 RB트리 속성을 위반했다면 재조정하는 메서드
-void rbtree_erase_fixup(rbtree *t, node_t *cur) {
+// cur가 nil일 수 있으므로 cur의 부모는 parent로 따로 받음 (회전 후에도 cur의 부모는 그대로)
+void rbtree_erase_fixup(rbtree *t, node_t *cur, node_t *parent) {
   node_t *sibling = t->nil;
-  while (cur != t->root && cur->color == RBTREE_BLACK) {
-    if (cur == cur->parent->left) {                 // cur가 부모의 왼쪽 자식일 때
-      sibling = cur->parent->right;                 // 형제는 부모의 오른쪽 자식
+  while (cur != t->root && rb_color(cur) == RBTREE_BLACK) {
+    RBTREE_COUNT(t, erase_fixups, 1);
+    if (cur == parent->left) {                      // cur가 부모의 왼쪽 자식일 때
+      sibling = parent->right;                      // 형제는 부모의 오른쪽 자식
       // Case 1-1: DOUBLY BLACK의 오른쪽 형제가 RED일 때
       // → 부모와 형제의 색을 바꾸고 부모를 기준으로 왼쪽으로 회전한 뒤, DOUBLY BLACK을 기준으로 Case 2, 3, 4 중 하나로 해결
-      if (sibling->color == RBTREE_RED) {
-        color_t tmp = sibling->color;
-        sibling->color = sibling->parent->color;    // 형제를 부모의 색으로
-        sibling->parent->color = tmp;               // 부모를 형제의 색으로
-        left_rotate(t, cur->parent);                // 부모를 기준으로 왼쪽으로 회전
-        sibling = cur->parent->right;               // 새로운 형제를 기준으로 Case 2, 3, 4 중 하나로 해결
+      if (rb_color(sibling) == RBTREE_RED) {
+        color_t tmp = rb_color(sibling);
+        rb_set_color(sibling, rb_color(rb_parent(sibling))); // 형제를 부모의 색으로
+        rb_set_color(rb_parent(sibling), tmp);      // 부모를 형제의 색으로
+        left_rotate(t, parent);                     // 부모를 기준으로 왼쪽으로 회전
+        sibling = parent->right;                    // 새로운 형제를 기준으로 Case 2, 3, 4 중 하나로 해결
       }
       // Case 2: DOUBLY BLACK의 형제가 BLACK and 그 형제의 두 자녀가 모두 BLACK일 때
       // → DOUBLY BLACK과 그 형제의 BLACK을 모두 모아서 부모에게 전달해서 부모가 EXTRA BLACK을 해결하도록 한다
-      if (sibling->left->color == RBTREE_BLACK && sibling->right->color == RBTREE_BLACK) {
-        sibling->color = RBTREE_RED;                // (cur를 순수한 BLACK으로 만들고) 형제를 RED로
-        cur = cur->parent;                          // (부모에게 EXTRA BLACK을 전달해) 부모를 기준으로 확인
+      if (rb_color(sibling->left) == RBTREE_BLACK && rb_color(sibling->right) == RBTREE_BLACK) {
+        rb_set_color(sibling, RBTREE_RED);          // (cur를 순수한 BLACK으로 만들고) 형제를 RED로
+        cur = parent;                               // (부모에게 EXTRA BLACK을 전달해) 부모를 기준으로 확인
+        parent = rb_parent(cur);
       } else {
         // Case 3-1: DOUBLY BLACK의 오른쪽 형제가 BLACK and 그 형제의 왼쪽 자녀가 RED and 오른쪽 자녀가 BLACK일 때
         // → (DOUBLY BLACK의 형제의 오른쪽 자녀를 RED가 되게 만들어서)
         // → 형제와 형제의 왼쪽 자식 색을 바꾸고 형제를 기준으로 오른쪽으로 회전하면 형제는 RED인 오른쪽 자식을 가진 BLACK이 됨
         // → 이후에는 Case 4를 적용하여 해결
-        if (sibling->right->color == RBTREE_BLACK) {
-          sibling->left->color = RBTREE_BLACK;      // 형제의 왼쪽 자식을 BLACK으로
-          sibling->color = RBTREE_RED;              // 형제를 RED로
+        if (rb_color(sibling->right) == RBTREE_BLACK) {
+          rb_set_color(sibling->left, RBTREE_BLACK); // 형제의 왼쪽 자식을 BLACK으로
+          rb_set_color(sibling, RBTREE_RED);        // 형제를 RED로
           right_rotate(t, sibling);                 // 형제를 기준으로 오른쪽으로 회전
-          sibling = cur->parent->right;             // 새로운 형제를 기준으로 Case 4로 해결
+          sibling = parent->right;                  // 새로운 형제를 기준으로 Case 4로 해결
         }
         // Case 4-1: DOUBLY BLACK의 오른쪽 형제가 BLACK and 그 형제의 오른쪽 자녀가 RED일 때
         // → 오른쪽 형제는 부모의 색으로, 오른쪽 형제의 오른쪽 자녀는 BLACK으로, 부모는 BLACK으로 바꾼 후에 부모를 기준으로 왼쪽으로 회전하면 해결
-        sibling->color = cur->parent->color;        // 형제를 부모의 색으로
-        sibling->right->color = RBTREE_BLACK;       // 형제의 오른쪽 자식을 BLACK으로
-        cur->parent->color = RBTREE_BLACK;          // 부모를 BLACK으로
-        left_rotate(t, cur->parent);                // 부모를 기준으로 왼쪽으로 회전
+        rb_set_color(sibling, rb_color(parent));    // 형제를 부모의 색으로
+        rb_set_color(sibling->right, RBTREE_BLACK); // 형제의 오른쪽 자식을 BLACK으로
+        rb_set_color(parent, RBTREE_BLACK);         // 부모를 BLACK으로
+        left_rotate(t, parent);                     // 부모를 기준으로 왼쪽으로 회전
         cur = t->root;                              // cur가 루트가 되면 루프 조건 검사 때 while 루프가 종료됨
       }
     } else {                                        // cur가 부모의 오른쪽 자식일 때
-      sibling = cur->parent->left;
+      sibling = parent->left;
       // Case 1-2: DOUBLY BLACK의 왼쪽 형제가 RED일 때
       // → 부모와 형제의 색을 바꾸고 부모를 기준으로 오른쪽으로 회전한 뒤 DOUBLY BLACK을 기준으로 Case 2, 3, 4 중 하나로 해결
-      if (sibling->color == RBTREE_RED) {
-        color_t tmp = sibling->color;
-        sibling->color = sibling->parent->color;    // 형제를 부모의 색으로
-        sibling->parent->color = tmp;               // 부모를 형제의 색으로
-        right_rotate(t, cur->parent);               // 부모를 기준으로 오른쪽으로 회전
-        sibling = cur->parent->left;                // 새로운 형제를 기준으로 Case 2, 3, 4 중 하나로 해결
+      if (rb_color(sibling) == RBTREE_RED) {
+        color_t tmp = rb_color(sibling);
+        rb_set_color(sibling, rb_color(rb_parent(sibling))); // 형제를 부모의 색으로
+        rb_set_color(rb_parent(sibling), tmp);      // 부모를 형제의 색으로
+        right_rotate(t, parent);                    // 부모를 기준으로 오른쪽으로 회전
+        sibling = parent->left;                     // 새로운 형제를 기준으로 Case 2, 3, 4 중 하나로 해결
       }
       // Case 2: DOUBLY BLACK의 형제가 BLACK and 그 형제의 두 자녀가 모두 BLACK일 때
       // → DOUBLY BLACK과 그 형제의 BLACK을 모두 모아서 부모에게 전달해서 부모가 EXTRA BLACK을 해결하도록 한다
-      if (sibling->right->color == RBTREE_BLACK && sibling->left->color == RBTREE_BLACK) {
-        sibling->color = RBTREE_RED;                // (cur를 순수한 BLACK으로 만들고) 형제를 RED로
-        cur = cur->parent;                          // (부모에게 EXTRA BLACK을 전달해) 부모를 기준으로 확인
+      if (rb_color(sibling->right) == RBTREE_BLACK && rb_color(sibling->left) == RBTREE_BLACK) {
+        rb_set_color(sibling, RBTREE_RED);          // (cur를 순수한 BLACK으로 만들고) 형제를 RED로
+        cur = parent;                               // (부모에게 EXTRA BLACK을 전달해) 부모를 기준으로 확인
+        parent = rb_parent(cur);
       } else {
         // Case 3-2: DOUBLY BLACK의 왼쪽 형제가 BLACK and 그 형제의 오른쪽 자녀가 RED and 왼쪽 자녀가 BLACK일 때
         // → (DOUBLY BLACK의 형제의 왼쪽 자녀를 RED가 되게 만들어서)
         // → 형제와 형제의 오른쪽 자식의 색을 바꾸고 형제를 기준으로 왼쪽으로 회전하면 형제는 RED인 왼쪽 자식을 가진 BLACK이 됨
         // → 이후에는 Case 4를 적용하여 해결
-        if (sibling->left->color == RBTREE_BLACK) {
-          sibling->right->color = RBTREE_BLACK;     // 형제의 오른쪽 자식을 BLACK으로
-          sibling->color = RBTREE_RED;              // 형제를 RED로
+        if (rb_color(sibling->left) == RBTREE_BLACK) {
+          rb_set_color(sibling->right, RBTREE_BLACK); // 형제의 오른쪽 자식을 BLACK으로
+          rb_set_color(sibling, RBTREE_RED);        // 형제를 RED로
           left_rotate(t, sibling);                  // 형제를 기준으로 왼쪽으로 회전
-          sibling = cur->parent->left;              // 새로운 형제를 기준으로 Case 4로 해결
+          sibling = parent->left;                   // 새로운 형제를 기준으로 Case 4로 해결
         }
         // Case 4-2: DOUBLY BLACK의 왼쪽 형제가 BLACK and 그 형제의 왼쪽 자녀가 RED일 때
         // → 왼쪽 형제는 부모의 색으로, 왼쪽 형제의 왼쪽 자녀는 BLACK으로, 부모는 BLACK으로 바꾼 후에 부모를 기준으로 오른쪽으로 회전하면 해결
-        sibling->color = cur->parent->color;        // 형제를 부모의 색으로
-        sibling->left->color = RBTREE_BLACK;        // 형제의 왼쪽 자식을 BLACK으로
-        cur->parent->color = RBTREE_BLACK;          // 부모를 BLACK으로
-        right_rotate(t, cur->parent);               // 부모를 기준으로 오른쪽으로 회전
+        rb_set_color(sibling, rb_color(parent));    // 형제를 부모의 색으로
+        rb_set_color(sibling->left, RBTREE_BLACK);  // 형제의 왼쪽 자식을 BLACK으로
+        rb_set_color(parent, RBTREE_BLACK);         // 부모를 BLACK으로
+        right_rotate(t, parent);                    // 부모를 기준으로 오른쪽으로 회전
         cur = t->root;                              // cur가 루트가 되면 루프 조건 검사 때 while 루프가 종료됨
       }
     }
   }
-  cur->color = RBTREE_BLACK;                        // 루트를 BLACK으로
+  if (cur != t->nil) rb_set_color(cur, RBTREE_BLACK);  // 루트를 BLACK으로
+}
+
+static int rbtree_fork_depth;                       // thread로 나눌 최대 재귀 깊이 (CPU 수로 정함)
+static pthread_once_t rbtree_fork_once = PTHREAD_ONCE_INIT;
+
+static void rbtree_fork_init(void) {
+#ifdef RBTREE_FORK_DEPTH
+  rbtree_fork_depth = RBTREE_FORK_DEPTH;
+#else
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);        // CPU 수만큼의 thread가 생기는 깊이
+  int depth = 0;
+  while (ncpu > 1L << depth) depth++;
+  rbtree_fork_depth = depth;
+#endif
+}
+
+// 큰 작업을 나눌 때 thread를 만들 최대 재귀 깊이를 반환하는 메서드 (-DRBTREE_FORK_DEPTH로 고정 가능)
+// 여러 thread가 동시에 처음 부를 수 있으므로 pthread_once로 한 번만 정함
+static int rbtree_thread_depth(void) {
+  pthread_once(&rbtree_fork_once, rbtree_fork_init);
+  return rbtree_fork_depth;
 }
 
 int rbtree_to_array(const rbtree *t, key_t *arr, const size_t n) {
   if (t == NULL || arr == NULL || n == 0) return 1;
-  int idx = 0;
-  rbtree_inorder_traversal(t, t->root, arr, &idx, n);
+  rbtree_export(t, t->root, arr, n, 0);
+  return 0;
+}
+
+// p 서브트리의 작은 key부터 n개(서브트리가 작으면 전부)를 arr에 쓰고 쓴 수를 반환하는 메서드
+// 재귀 없이 왼쪽 경로를 stack에 쌓으며 내려가고, n개를 채우면 바로 멈춤
+size_t rbtree_copy_keys(const rbtree *t, const node_t *p, key_t *arr, const size_t n) {
+  const node_t *stack[RBTREE_MAX_HEIGHT];
+  size_t i = 0;
+  int top = 0;
+  while (i < n) {
+    for (; p != t->nil; p = p->left) stack[top++] = p;
+    if (top == 0) break;
+    p = stack[--top];
+    for (size_t c = rb_count(p); c > 0 && i < n; c--) arr[i++] = p->key;
+    p = p->right;
+  }
+  return i;
+}
+
+typedef struct {
+  const rbtree *t;
+  const node_t *p;
+  key_t *arr;
+  size_t n;
+  int depth;
+} rbtree_export_arg_t;
+
+static void *rbtree_export_thread(void *arg) {
+  rbtree_export_arg_t *e = (rbtree_export_arg_t *)arg;
+  rbtree_export(e->t, e->p, e->arr, e->n, e->depth);
+  return NULL;
+}
+
+// p 서브트리의 작은 key부터 n개를 arr에 쓰는 메서드
+// 큰 서브트리는 왼쪽 서브트리를 다른 thread에 맡기고, 오른쪽은 서브트리 크기로 구한 위치부터 바로 씀
+void rbtree_export(const rbtree *t, const node_t *p, key_t *arr, const size_t n, const int depth) {
+  size_t m = n < p->size ? n : p->size;
+  if (depth >= rbtree_thread_depth() || m < RBTREE_EXPORT_GRAIN) {
+    rbtree_copy_keys(t, p, arr, m);
+    return;
+  }
+  size_t nl = p->left->size, c = rb_count(p);
+  if (m <= nl) {                                    // 왼쪽 서브트리만으로 채워짐
+    rbtree_export(t, p->left, arr, m, depth);
+    return;
+  }
+  rbtree_export_arg_t left = {t, p->left, arr, nl, depth + 1};
+  pthread_t tid;
+  int forked = pthread_create(&tid, NULL, rbtree_export_thread, &left) == 0;
+  if (!forked) rbtree_copy_keys(t, p->left, arr, nl);
+  for (size_t i = nl; i < nl + c && i < m; i++) arr[i] = p->key;
+  if (m > nl + c) rbtree_export(t, p->right, arr + nl + c, m - nl - c, depth + 1);
+  if (forked) pthread_join(tid, NULL);
+}
+
+// tree의 key를 순서대로 buf에 cap개씩 채워 flush에 넘기고 넘긴 key 수를 반환하는 메서드
+// flush가 0이 아닌 값을 반환하면 멈추며, 전체 key를 담을 배열 없이 cap개 크기의 buffer만 사용
+size_t rbtree_to_array_stream(const rbtree *t, key_t *buf, const size_t cap, rbtree_flush_t flush, void *arg) {
+  if (t == NULL || buf == NULL || cap == 0 || flush == NULL) return 0;
+  const node_t *stack[RBTREE_MAX_HEIGHT];
+  const node_t *p = t->root;
+  size_t total = 0, i = 0;
+  int top = 0;
+  for (;;) {
+    for (; p != t->nil; p = p->left) stack[top++] = p;
+    if (top == 0) break;
+    p = stack[--top];
+    for (size_t c = rb_count(p); c > 0; c--) {
+      buf[i++] = p->key;
+      if (i == cap) {
+        total += i;
+        i = 0;
+        if (flush(buf, cap, arg)) return total;
+      }
+    }
+    p = p->right;
+  }
+  if (i > 0) {
+    total += i;
+    flush(buf, i, arg);
+  }
+  return total;
+}
+
+size_t rbtree_size(const rbtree *t) {
+  if (t == NULL) return 0;
+  return t->root->size;
+}
+
+// p 서브트리의 노드 수와 깊이별 분포를 st에 더하는 메서드
+static void rbtree_stats_traverse(const rbtree *t, const node_t *p, int depth, rbtree_stats_t *st) {
+  while (p != t->nil) {
+    st->nodes++;
+    if (depth + 1 > st->height) st->height = depth + 1;
+    st->depth_hist[depth < RBTREE_STATS_MAX_DEPTH ? depth : RBTREE_STATS_MAX_DEPTH - 1]++;
+    rbtree_stats_traverse(t, p->left, depth + 1, st);
+    p = p->right;
+    depth++;
+  }
+}
+
+// tree의 구조 통계와 연산 counter를 st에 채우는 메서드
+void rbtree_stats(const rbtree *t, rbtree_stats_t *st) {
+  if (st == NULL) return;
+  memset(st, 0, sizeof(*st));
+  if (t == NULL) return;
+#ifdef RBTREE_STATS
+  st->counters = t->counters;
+#endif
+  st->keys = t->root->size;
+  st->black_height = rbtree_black_height(t);
+  rbtree_stats_traverse(t, t->root, 0, st);
+}
+
+// 연산 counter를 0으로 되돌리는 메서드
+void rbtree_stats_reset(rbtree *t) {
+#ifdef RBTREE_STATS
+  if (t != NULL) memset(&t->counters, 0, sizeof(t->counters));
+#else
+  (void)t;
+#endif
+}
+
+// 0부터 센 k번째로 작은 key를 가진 노드를 반환 (rbtree_to_array 결과의 arr[k])
+node_t *rbtree_select(const rbtree *t, const size_t k) {
+  if (t == NULL || k >= t->root->size) return NULL;
+  node_t *cur = t->root;
+  size_t i = k;
+  while (cur != t->nil) {
+    size_t left = cur->left->size;
+    if (i < left) cur = cur->left;
+    else if (i < left + rb_count(cur)) return cur;
+    else {
+      i -= left + rb_count(cur);
+      cur = cur->right;
+    }
+  }
+  return NULL;
+}
+
+// key보다 작은 key의 개수를 반환 (key가 정렬된 배열에 들어갈 위치)
+size_t rbtree_rank(const rbtree *t, const key_t key) {
+  if (t == NULL) return 0;
+  size_t rank = 0;
+  node_t *cur = t->root;
+  while (cur != t->nil) {
+    if (cur->key < key) {
+      rank += cur->left->size + rb_count(cur);
+      cur = cur->right;
+    } else cur = cur->left;
+  }
+  return rank;
+}
+
+// 중위 순서로 p 다음 노드를 반환 (부모 포인터를 따라 올라가므로 재귀/할당 없음)
+node_t *rbtree_next(const rbtree *t, const node_t *p) {
+  if (t == NULL || p == NULL || p == t->nil) return NULL;
+  if (p->right != t->nil) {                         // 오른쪽 서브트리의 최솟값
+    node_t *cur = p->right;
+    while (cur->left != t->nil) cur = cur->left;
+    return cur;
+  }
+  node_t *cur = rb_parent(p);                       // 왼쪽 자식으로 올라오는 첫 조상
+  while (cur != t->nil && p == cur->right) {
+    p = cur;
+    cur = rb_parent(cur);
+  }
+  return cur == t->nil ? NULL : cur;
+}
+
+// 중위 순서로 p 이전 노드를 반환
+node_t *rbtree_prev(const rbtree *t, const node_t *p) {
+  if (t == NULL || p == NULL || p == t->nil) return NULL;
+  if (p->left != t->nil) {                          // 왼쪽 서브트리의 최댓값
+    node_t *cur = p->left;
+    while (cur->right != t->nil) cur = cur->right;
+    return cur;
+  }
+  node_t *cur = rb_parent(p);                       // 오른쪽 자식으로 올라오는 첫 조상
+  while (cur != t->nil && p == cur->left) {
+    p = cur;
+    cur = rb_parent(cur);
+  }
+  return cur == t->nil ? NULL : cur;
+}
+
+// key 이상인 첫 노드를 반환
+node_t *rbtree_lower_bound(const rbtree *t, const key_t key) {
+  if (t == NULL) return NULL;
+  node_t *cur = t->root;
+  node_t *res = NULL;
+  while (cur != t->nil) {
+    RBTREE_COUNT(t, comparisons, 1);
+    if (cur->key < key) cur = cur->right;
+    else {
+      res = cur;
+      cur = cur->left;
+    }
+  }
+  return res;
+}
+
+// key보다 큰 첫 노드를 반환
+node_t *rbtree_upper_bound(const rbtree *t, const key_t key) {
+  if (t == NULL) return NULL;
+  node_t *cur = t->root;
+  node_t *res = NULL;
+  while (cur != t->nil) {
+    RBTREE_COUNT(t, comparisons, 1);
+    if (cur->key > key) {
+      res = cur;
+      cur = cur->left;
+    } else cur = cur->right;
+  }
+  return res;
+}
+
+// [lo, hi) 구간의 노드를 key 순서대로 방문하고 방문한 key 수를 반환
+size_t rbtree_range_scan(const rbtree *t, const key_t lo, const key_t hi, rbtree_visit_t visit, void *arg) {
+  size_t cnt = 0;
+  for (node_t *p = rbtree_lower_bound(t, lo); p != NULL && p->key < hi; p = rbtree_next(t, p)) {
+    cnt += rb_count(p);
+    if (visit != NULL && visit(p, arg)) break;
+  }
+  return cnt;
+}
+
+// [lo, hi]와 겹치는 구간을 key 순서대로 방문하고 방문한 key 수를 반환
+// 점 구간뿐이면 [lo, hi]의 key를 차례로 방문하는 것과 같음
+size_t rbtree_overlaps(const rbtree *t, const key_t lo, const key_t hi, rbtree_visit_t visit, void *arg) {
+  size_t cnt = 0;
+  if (t == NULL || hi < lo) return 0;
+#ifdef RBTREE_INTERVAL
+  rbtree_overlaps_node(t, t->root, lo, hi, visit, arg, &cnt);
+#else
+  for (node_t *p = rbtree_lower_bound(t, lo); p != NULL && p->key <= hi; p = rbtree_next(t, p)) {
+    cnt += rb_count(p);
+    if (visit != NULL && visit(p, arg)) break;
+  }
+#endif
+  return cnt;
+}
+
+#ifdef RBTREE_INTERVAL
+// p 서브트리에서 겹치는 노드를 중위 순서로 방문하는 메서드 (visit가 멈추게 했으면 1)
+// max_end < lo인 서브트리와 key > hi인 노드의 오른쪽 서브트리에는 겹치는 구간이 없으므로 내려가지 않음
+int rbtree_overlaps_node(const rbtree *t, node_t *p, const key_t lo, const key_t hi, rbtree_visit_t visit, void *arg, size_t *cnt) {
+  while (p != t->nil && p->max_end >= lo) {
+    if (rbtree_overlaps_node(t, p->left, lo, hi, visit, arg, cnt)) return 1;
+    if (p->key > hi) return 0;
+    if (p->end >= lo) {
+      (*cnt)++;
+      if (visit != NULL && visit(p, arg)) return 1;
+    }
+    p = p->right;                                   // 오른쪽은 반복으로 내려가므로 재귀 깊이는 왼쪽 경로만큼
+  }
+  return 0;
+}
+#endif
+
+// 루트에서 가장 왼쪽 nil까지의 BLACK 노드 수를 반환 (nil 제외)
+int rbtree_black_height(const rbtree *t) {
+  int h = 0;
+  for (const node_t *p = t->root; p != t->nil; p = p->left) h += rb_color(p) == RBTREE_BLACK;
+  return h;
+}
+
+// a의 모든 key <= k->key <= b의 모든 key일 때 a, k, b를 이은 서브트리의 루트를 반환하는 메서드
+// a와 b는 루트가 BLACK(또는 nil)이고 black height가 ha, hb인 독립된 서브트리, 결과의 black height는 *h
+// 낮은 쪽 서브트리를 높은 쪽의 가장자리에서 같은 black height인 위치에 k와 함께 붙이고 삽입과 같이 재조정
+node_t *rbtree_join_node(rbtree *t, node_t *a, int ha, node_t *k, node_t *b, int hb, int *h) {
+  rb_set_parent(k, t->nil);
+  if (ha == hb) {                                   // 높이가 같으면 k가 새 루트
+    k->left = a;
+    k->right = b;
+    if (a != t->nil) rb_set_parent(a, k);
+    if (b != t->nil) rb_set_parent(b, k);
+    rb_set_color(k, RBTREE_BLACK);
+    k->size = a->size + b->size + rb_count(k);
+    rbtree_max_end_pull(t, k);
+    *h = ha + 1;
+    return k;
+  }
+  // 회전과 재조정은 높은 쪽 서브트리를 tree로 보고 수행
+  rbtree sub = {.root = ha > hb ? a : b, .nil = t->nil, .pool = t->pool};
+  node_t *low = ha > hb ? b : a;
+  int lh = ha > hb ? hb : ha;
+  int ch = ha > hb ? ha : hb;                       // cur의 black height
+  node_t *prev = t->nil;
+  node_t *cur = sub.root;
+  while (rb_color(cur) == RBTREE_RED || ch > lh) {  // 높이가 lh인 BLACK 노드를 가장자리에서 찾음
+    if (rb_color(cur) == RBTREE_BLACK) ch--;
+    prev = cur;
+    cur = ha > hb ? cur->right : cur->left;
+  }
+  if (ha > hb) {
+    k->left = cur;
+    k->right = low;
+    prev->right = k;
+  } else {
+    k->left = low;
+    k->right = cur;
+    prev->left = k;
+  }
+  if (cur != t->nil) rb_set_parent(cur, k);
+  if (low != t->nil) rb_set_parent(low, k);
+  rb_set_parent(k, prev);
+  rb_set_color(k, RBTREE_RED);
+  k->size = cur->size + low->size + rb_count(k);
+  for (node_t *p = prev; p != t->nil; p = rb_parent(p)) p->size += low->size + rb_count(k);
+  rbtree_max_end_pull(t, k);
+  rbtree_max_end_raise(t, prev, k->max_end);
+  *h = (ha > hb ? ha : hb) + rbtree_insert_fixup(&sub, k);
+  RBTREE_COUNT_MERGE(t, &sub);
+  return sub.root;
+}
+
+// black height가 h인 서브트리 x를 key 미만(*l)과 이상(*r)으로 나누는 메서드 (incl이면 key 이하와 초과로)
+// x의 경로를 따라 내려가며 떨어져 나온 서브트리를 join으로 이어 붙임 (높이 차의 합이 O(log n))
+void rbtree_split_node(rbtree *t, node_t *x, int h, const key_t key, const int incl, node_t **l, int *lh, node_t **r, int *rh) {
+  if (x == t->nil) {
+    *l = *r = t->nil;
+    *lh = *rh = 0;
+    return;
+  }
+  node_t *left = x->left, *right = x->right;
+  int hl = h - (rb_color(x) == RBTREE_BLACK), hr = hl;
+  if (left != t->nil) rb_set_parent(left, t->nil);
+  if (right != t->nil) rb_set_parent(right, t->nil);
+  if (rb_color(left) == RBTREE_RED) {               // 떼어낸 서브트리의 루트는 BLACK으로
+    rb_set_color(left, RBTREE_BLACK);
+    hl++;
+  }
+  if (rb_color(right) == RBTREE_RED) {
+    rb_set_color(right, RBTREE_BLACK);
+    hr++;
+  }
+  node_t *sub;
+  int hs;
+  if (x->key < key || (incl && x->key == key)) {    // x와 왼쪽 서브트리는 모두 왼쪽으로
+    rbtree_split_node(t, right, hr, key, incl, &sub, &hs, r, rh);
+    *l = rbtree_join_node(t, left, hl, x, sub, hs, lh);
+  } else {
+    rbtree_split_node(t, left, hl, key, incl, l, lh, &sub, &hs);
+    *r = rbtree_join_node(t, sub, hs, x, right, hr, rh);
+  }
+}
+
+// black height가 h인 서브트리 x를 작은 쪽 key rank개(*l)와 나머지(*r)로 나누는 메서드 (key 대신 순위로 나누는 split)
+// RBTREE_COUNTED에서 경계가 노드 안에 걸치면 그 노드는 *r로 보내므로 *l의 key 수는 rank보다 적을 수 있음
+void rbtree_split_rank_node(rbtree *t, node_t *x, int h, size_t rank, node_t **l, int *lh, node_t **r, int *rh) {
+  if (x == t->nil) {
+    *l = *r = t->nil;
+    *lh = *rh = 0;
+    return;
+  }
+  node_t *left = x->left, *right = x->right;
+  int hl = h - (rb_color(x) == RBTREE_BLACK), hr = hl;
+  if (left != t->nil) rb_set_parent(left, t->nil);
+  if (right != t->nil) rb_set_parent(right, t->nil);
+  if (rb_color(left) == RBTREE_RED) {
+    rb_set_color(left, RBTREE_BLACK);
+    hl++;
+  }
+  if (rb_color(right) == RBTREE_RED) {
+    rb_set_color(right, RBTREE_BLACK);
+    hr++;
+  }
+  node_t *sub;
+  int hs;
+  if (left->size + rb_count(x) <= rank) {           // x와 왼쪽 서브트리는 모두 앞쪽 rank개 안에 듦
+    rbtree_split_rank_node(t, right, hr, rank - left->size - rb_count(x), &sub, &hs, r, rh);
+    *l = rbtree_join_node(t, left, hl, x, sub, hs, lh);
+  } else {
+    rbtree_split_rank_node(t, left, hl, rank, l, lh, &sub, &hs);
+    *r = rbtree_join_node(t, sub, hs, x, right, hr, rh);
+  }
+}
+
+// t2가 쓰는 pool을 t1의 pool로 합치는 메서드 (chunk 목록과 free list를 O(1)에 이어 붙임)
+void rbtree_pool_merge(rbtree *t1, rbtree *t2) {
+  node_pool_t *p1 = rbtree_pool(t1), *p2 = rbtree_pool(t2);
+  if (p1 == p2) return;
+  if (p2->chunks != NULL) {
+    p2->last_chunk->next = p1->chunks;
+    if (p1->chunks == NULL) p1->last_chunk = p2->last_chunk;
+    p1->chunks = p2->chunks;
+  }
+  if (p2->free_list != NULL) {
+    p2->free_tail->right = p1->free_list;
+    if (p1->free_list == NULL) p1->free_tail = p2->free_tail;
+    p1->free_list = p2->free_list;
+  }
+  p1->free_count += p2->free_count;
+  p2->chunks = p2->last_chunk = NULL;
+  p2->free_list = p2->free_tail = NULL;
+  p2->free_count = 0;
+  p2->forward = p1;                                 // t2처럼 p2를 쓰던 tree는 다음 접근 때 p1으로 옮겨감
+  p1->refs++;
+  rbtree_pool(t2);
+}
+
+// t1의 모든 key <= t2의 모든 key일 때 t2의 노드를 t1으로 옮기는 메서드 (t2는 빈 tree가 됨)
+int rbtree_join(rbtree *t1, rbtree *t2) {
+  if (t1 == NULL || t2 == NULL || t1 == t2) return 1;
+  if (t2->root == t2->nil) return 0;
+  if (t1->root != t1->nil && rbtree_max(t1)->key > rbtree_min(t2)->key) return 1;
+  rbtree_pool_merge(t1, t2);
+  node_t *k = rbtree_min(t2);                       // t2의 최솟값을 떼어 가운데 노드로 사용
+  rbtree_unlink(t2, k);
+  int h1 = rbtree_black_height(t1), h2 = rbtree_black_height(t2), h;
+  t1->root = rbtree_join_node(t1, t1->root, h1, k, t2->root, h2, &h);
+  t2->root = t2->nil;
+  rbtree_update_edges(t1);
+  rbtree_update_edges(t2);
   return 0;
 }
 
-// RB 트리를 중위 순회하는 메서드
-void rbtree_inorder_traversal(const rbtree *t, node_t *p, key_t *arr, int *idx, size_t n) {
-  if (p != t->nil && *idx < n) {
-    rbtree_inorder_traversal(t, p->left, arr, idx, n);
-    arr[(*idx)++] = p->key;
-    rbtree_inorder_traversal(t, p->right, arr, idx, n);
+// key 미만의 노드는 *lo, 이상의 노드는 *hi인 새 tree로 옮기는 메서드 (t는 빈 tree가 됨)
+int rbtree_split(rbtree *t, const key_t key, rbtree **lo, rbtree **hi) {
+  if (t == NULL || lo == NULL || hi == NULL) return 1;
+  *lo = rbtree_new_shared(t);
+  *hi = rbtree_new_shared(t);
+  if (*lo == NULL || *hi == NULL) {
+    delete_rbtree(*lo);
+    delete_rbtree(*hi);
+    *lo = *hi = NULL;
+    return 1;
   }
-}
\ No newline at end of file
+  int h = rbtree_black_height(t), lh, rh;
+  rbtree_split_node(t, t->root, h, key, 0, &(*lo)->root, &lh, &(*hi)->root, &rh);
+  t->root = t->nil;
+  rbtree_update_edges(t);
+  rbtree_update_edges(*lo);
+  rbtree_update_edges(*hi);
+  return 0;
+}
+
+// 두 서브트리 a, b를 가운데 노드 없이 잇는 메서드 (b의 최솟값을 떼어 가운데 노드로 사용)
+// 떼어내면서 b의 black height가 바뀔 수 있으므로 b의 높이는 받지 않고 떼어낸 뒤에 셈
+node_t *rbtree_join2(rbtree *t, node_t *a, int ha, node_t *b, int *h) {
+  if (b == t->nil) {
+    *h = ha;
+    return a;
+  }
+  rbtree sub = {.root = b, .nil = t->nil, .pool = t->pool};
+  node_t *k = b;
+  while (k->left != t->nil) k = k->left;
+  rbtree_unlink(&sub, k);
+  RBTREE_COUNT_MERGE(t, &sub);
+  return rbtree_join_node(t, a, ha, k, sub.root, rbtree_black_height(&sub), h);
+}
+
+// 집합 연산 (std::set_union 등과 같은 multiset 의미)
+// 결과에서 key의 개수는 union이면 max(a, b), intersection이면 min(a, b), difference이면 max(a - b, 0)
+typedef enum { RBTREE_UNION, RBTREE_INTERSECTION, RBTREE_DIFFERENCE } rbtree_setop_t;
+
+// 결과에서 빠진 노드 목록 (right 포인터로 연결, 연산이 끝난 뒤 free list에 한 번에 붙임)
+typedef struct {
+  node_t *head, *tail;
+} rbtree_trash_t;
+
+typedef struct {
+  rbtree *t;
+  rbtree_setop_t op;
+  node_t *a, *b, *res;
+  int ha, hb, h, depth;
+  rbtree_trash_t trash;
+  rbtree local;  // 다른 thread가 쓰는 tree (counter를 따로 세고 join한 뒤 t에 더함)
+} rbtree_setop_arg_t;
+
+// 서브트리 p의 노드를 모두 trash에 넣는 메서드
+static void rbtree_trash_tree(rbtree *t, node_t *p, rbtree_trash_t *trash) {
+  while (p != t->nil) {
+    rbtree_trash_tree(t, p->left, trash);
+    node_t *right = p->right;
+    p->right = trash->head;
+    if (trash->head == NULL) trash->tail = p;
+    trash->head = p;
+    p = right;
+  }
+}
+
+// trash의 노드를 free list에 한 번에 붙이는 메서드
+static void rbtree_trash_free(rbtree *t, rbtree_trash_t *trash) {
+  if (trash->head == NULL) return;
+  node_pool_t *pool = rbtree_pool(t);
+  size_t cnt = 0;
+  for (node_t *p = trash->head; p != NULL; p = p->right) cnt++;
+  pool->free_count += cnt;
+  RBTREE_COUNT(t, frees, cnt);
+  trash->tail->right = pool->free_list;
+  if (pool->free_list == NULL) pool->free_tail = trash->tail;
+  pool->free_list = trash->head;
+  trash->head = trash->tail = NULL;
+}
+
+static void rbtree_trash_append(rbtree_trash_t *dst, rbtree_trash_t *src) {
+  if (src->head == NULL) return;
+  src->tail->right = dst->head;
+  if (dst->head == NULL) dst->tail = src->tail;
+  dst->head = src->head;
+}
+
+// 모두 같은 key인 서브트리 *x에서 cnt개를 덜어내는 메서드
+static void rbtree_trim_equal(rbtree *t, node_t **x, size_t cnt, rbtree_trash_t *trash) {
+  if (cnt == 0) return;
+#ifdef RBTREE_COUNTED
+  (void)t;
+  (void)trash;
+  (*x)->count -= cnt;                               // 같은 key는 노드 하나이므로 개수만 줄임
+  (*x)->size -= cnt;
+#else
+  rbtree sub = {.root = *x, .nil = t->nil, .pool = t->pool};
+  for (size_t i = 0; i < cnt; i++) {
+    node_t *p = sub.root;
+    while (p->left != t->nil) p = p->left;
+    rbtree_unlink(&sub, p);
+    p->left = p->right = t->nil;
+    rbtree_trash_tree(t, p, trash);
+  }
+  RBTREE_COUNT_MERGE(t, &sub);
+  *x = sub.root;
+#endif
+}
+
+static void *rbtree_setop_thread(void *arg);
+
+// a와 b에 op를 적용한 서브트리를 반환하는 메서드 (a, b의 노드는 결과로 옮기거나 trash에 넣음)
+// b의 루트 key로 a와 b를 각각 미만, 같음, 초과로 나눈 뒤 양쪽을 재귀로 처리하고 join으로 이어 붙임
+static node_t *rbtree_setop(rbtree *t, rbtree_setop_t op, node_t *a, int ha, node_t *b, int hb, int *h,
+                            rbtree_trash_t *trash, int depth) {
+  if (a == t->nil || b == t->nil) {                 // 한쪽이 비었으면 남는 쪽이 정해짐
+    node_t *keep = t->nil;
+    *h = 0;
+    if (op == RBTREE_DIFFERENCE || (op == RBTREE_UNION && a != t->nil)) {
+      keep = a;
+      *h = ha;
+    } else if (op == RBTREE_UNION) {
+      keep = b;
+      *h = hb;
+    }
+    if (a != keep) rbtree_trash_tree(t, a, trash);
+    if (b != keep) rbtree_trash_tree(t, b, trash);
+    return keep;
+  }
+  const key_t key = b->key;
+  node_t *al, *ae, *ar, *bl, *be, *br, *rest;
+  int hal, hae, har, hbl, hbe, hbr, hrest;
+  rbtree_split_node(t, a, ha, key, 0, &al, &hal, &rest, &hrest);
+  rbtree_split_node(t, rest, hrest, key, 1, &ae, &hae, &ar, &har);
+  rbtree_split_node(t, b, hb, key, 0, &bl, &hbl, &rest, &hrest);
+  rbtree_split_node(t, rest, hrest, key, 1, &be, &hbe, &br, &hbr);
+
+  node_t *l, *r;
+  int hl, hr;
+  rbtree_setop_arg_t left = {.t = t, .op = op, .a = al, .b = bl, .ha = hal, .hb = hbl, .depth = depth + 1};
+  pthread_t tid;
+  int forked = depth < rbtree_thread_depth() && al->size + bl->size >= RBTREE_SETOP_GRAIN &&
+               ar->size + br->size >= RBTREE_SETOP_GRAIN &&
+               pthread_create(&tid, NULL, rbtree_setop_thread, &left) == 0;  // 왼쪽은 다른 thread에서
+  if (!forked) l = rbtree_setop(t, op, al, hal, bl, hbl, &hl, trash, depth + 1);
+  r = rbtree_setop(t, op, ar, har, br, hbr, &hr, trash, depth + 1);
+  if (forked) {
+    pthread_join(tid, NULL);
+    l = left.res;
+    hl = left.h;
+    rbtree_trash_append(trash, &left.trash);
+    RBTREE_COUNT_MERGE(t, &left.local);
+  }
+
+  size_t ca = ae->size, cb = be->size, c;           // 결과에 남길 key의 개수
+  if (op == RBTREE_UNION) c = ca > cb ? ca : cb;
+  else if (op == RBTREE_INTERSECTION) c = ca < cb ? ca : cb;
+  else c = ca > cb ? ca - cb : 0;
+  node_t *m = t->nil;
+  if (c > 0 && ca >= c) {                           // 개수가 충분한 쪽의 노드를 남기고 나머지는 버림
+    m = ae;
+    rbtree_trim_equal(t, &m, ca - c, trash);
+    rbtree_trash_tree(t, be, trash);
+  } else if (c > 0) {
+    m = be;
+    rbtree_trim_equal(t, &m, cb - c, trash);
+    rbtree_trash_tree(t, ae, trash);
+  } else {
+    rbtree_trash_tree(t, ae, trash);
+    rbtree_trash_tree(t, be, trash);
+  }
+
+  if (m != t->nil && m->left == t->nil && m->right == t->nil)  // 같은 key가 노드 하나면 그대로 가운데 노드로
+    return rbtree_join_node(t, l, hl, m, r, hr, h);
+  l = rbtree_join2(t, l, hl, m, &hl);
+  return rbtree_join2(t, l, hl, r, h);
+}
+
+static void *rbtree_setop_thread(void *arg) {
+  rbtree_setop_arg_t *p = (rbtree_setop_arg_t *)arg;
+  p->local = (rbtree){.root = p->t->nil, .nil = p->t->nil, .pool = p->t->pool};
+  p->res = rbtree_setop(&p->local, p->op, p->a, p->ha, p->b, p->hb, &p->h, &p->trash, p->depth);
+  return NULL;
+}
+
+// t1을 t1과 t2에 op를 적용한 결과로 바꾸는 메서드 (t2는 빈 tree가 됨)
+static int rbtree_setop_tree(rbtree *t1, rbtree *t2, rbtree_setop_t op) {
+  if (t1 == NULL || t2 == NULL || t1 == t2) return 1;
+  rbtree_pool_merge(t1, t2);
+  rbtree_trash_t trash = {NULL, NULL};
+  int h;
+  t1->root = rbtree_setop(t1, op, t1->root, rbtree_black_height(t1), t2->root, rbtree_black_height(t2), &h,
+                          &trash, 0);
+  t2->root = t2->nil;
+  rbtree_update_edges(t1);
+  rbtree_update_edges(t2);
+  rbtree_trash_free(t1, &trash);
+  return 0;
+}
+
+// t1을 t1 ∪ t2로 바꾸는 메서드 (t2는 빈 tree가 됨)
+int rbtree_union(rbtree *t1, rbtree *t2) {
+  return rbtree_setop_tree(t1, t2, RBTREE_UNION);
+}
+
+// t1을 t1 ∩ t2로 바꾸는 메서드 (t2는 빈 tree가 됨)
+int rbtree_intersection(rbtree *t1, rbtree *t2) {
+  return rbtree_setop_tree(t1, t2, RBTREE_INTERSECTION);
+}
+
+// t1을 t1 - t2로 바꾸는 메서드 (t2는 빈 tree가 됨)
+int rbtree_difference(rbtree *t1, rbtree *t2) {
+  return rbtree_setop_tree(t1, t2, RBTREE_DIFFERENCE);
+}
+
+// [lo, hi) 구간의 key를 모두 삭제하고 삭제한 key 수를 반환하는 메서드 (O(log n + k))
+// 구간을 split으로 떼어낸 뒤 남은 양쪽을 한 번 join하고, 떼어낸 노드는 free list에 한 번에 붙임
+size_t rbtree_erase_range(rbtree *t, const key_t lo, const key_t hi) {
+  if (t == NULL || t->root == t->nil || !(lo < hi)) return 0;
+  node_t *l, *mid, *r, *rest;
+  int hl, hm, hr, hrest, h;
+  rbtree_split_node(t, t->root, rbtree_black_height(t), lo, 0, &l, &hl, &rest, &hrest);
+  rbtree_split_node(t, rest, hrest, hi, 0, &mid, &hm, &r, &hr);
+  size_t cnt = mid->size;
+  rbtree_trash_t trash = {NULL, NULL};
+  rbtree_trash_tree(t, mid, &trash);
+  t->root = rbtree_join2(t, l, hl, r, &h);
+  rbtree_update_edges(t);
+  rbtree_trash_free(t, &trash);
+  return cnt;
+}
+
+// 최솟값을 꺼내 out에 쓰는 메서드 (같은 key가 여러 개면 하나만 꺼냄)
+int rbtree_pop_min(rbtree *t, key_t *out) {
+  if (t == NULL || t->root == t->nil) return 0;
+  if (out != NULL) *out = t->leftmost->key;
+  return rbtree_erase(t, t->leftmost);
+}
+
+// 최댓값을 꺼내 out에 쓰는 메서드
+int rbtree_pop_max(rbtree *t, key_t *out) {
+  if (t == NULL || t->root == t->nil) return 0;
+  if (out != NULL) *out = t->rightmost->key;
+  return rbtree_erase(t, t->rightmost);
+}
+
+// 작은 key부터 k개를 꺼내 out에 순서대로 쓰고 꺼낸 수를 반환하는 메서드 (O(log n + k))
+// 앞쪽 k개를 순위로 split해 한 번에 떼어내므로 같은 key가 경계에 몇 개 걸쳐 있어도 split은 한 번
+size_t rbtree_pop_min_n(rbtree *t, key_t *out, const size_t k) {
+  if (t == NULL || out == NULL) return 0;
+  size_t n = k < t->root->size ? k : t->root->size;
+  if (n == 0) return 0;
+  node_t *l, *r;
+  int hl, hr;
+  rbtree_split_rank_node(t, t->root, rbtree_black_height(t), n, &l, &hl, &r, &hr);
+  size_t idx = rbtree_copy_keys(t, l, out, n);
+  rbtree_trash_t trash = {NULL, NULL};
+  rbtree_trash_tree(t, l, &trash);
+  t->root = r;
+  rbtree_update_edges(t);
+  rbtree_trash_free(t, &trash);
+  if (idx < n) {                                    // RBTREE_COUNTED: 경계에 걸친 노드(새 최솟값)에서 남은 개수만 덜어냄
+    node_t *p = t->leftmost;
+    for (node_t *cur = p; cur != t->nil; cur = rb_parent(cur)) cur->size -= n - idx;
+#ifdef RBTREE_COUNTED
+    p->count -= n - idx;
+#endif
+    while (idx < n) out[idx++] = p->key;
+  }
+  return n;
+}
+
+// 노드 재배치: 흩어진 노드를 새 chunk 하나에 van Emde Boas 순서로 옮김
+// 크기가 block을 넘는 위쪽 노드를 먼저 옮긴 뒤, 그 아래의 크기가 block 이하인 서브트리를 key 순서대로 하나씩 옮김
+// 위쪽과 각 서브트리 안은 높이를 반으로 나눠 위 절반, 아래 서브트리들 순서로 재귀적으로 배치
+struct rbtree_compactor {
+  rbtree *t;
+  node_chunk_t *dst;                                // 옮겨 갈 chunk (free list에 넣지 않고 앞에서부터 채움)
+  size_t used;                                      // dst에서 채운 노드 수
+  size_t slice;                                     // step마다 옮길 노드 수
+  size_t block;                                     // 크기가 block 이하인 서브트리를 한 번에 옮김 (slice와 √n 중 큰 값)
+  size_t limit;                                     // 크기가 limit 이하인 서브트리는 지금 배치하는 범위 밖
+  size_t rank;                                      // 다음에 옮길 key의 순위 (다음 step이 rbtree_select로 여기서 이어감)
+  int top_done, done;
+};
+
+static inline int rbtree_compact_placed(const rbtree_compactor *c, const node_t *p) {
+  return p >= c->dst->nodes && p < c->dst->nodes + c->dst->cap;
+}
+
+static inline int rbtree_compact_inside(const rbtree_compactor *c, const node_t *p) {
+  return p != c->t->nil && p->size > c->limit;
+}
+
+// p를 dst의 다음 자리로 옮기고 새 주소를 반환하는 메서드 (이미 옮겼거나 dst가 찼으면 그대로)
+// p를 가리키던 부모와 자식, root, leftmost/rightmost를 고치고 비운 자리는 free list에 넣음 (nil은 쓰지 않음)
+static node_t *rbtree_compact_move(rbtree_compactor *c, node_t *p) {
+  rbtree *t = c->t;
+  if (rbtree_compact_placed(c, p) || c->used == c->dst->cap) return p;
+  node_t *q = &c->dst->nodes[c->used++];
+  *q = *p;
+  node_t *parent = rb_parent(p);
+  if (parent == t->nil) t->root = q;
+  else if (parent->left == p) parent->left = q;
+  else parent->right = q;
+  if (q->left != t->nil) rb_set_parent(q->left, q);
+  if (q->right != t->nil) rb_set_parent(q->right, q);
+  if (t->leftmost == p) t->leftmost = q;
+  if (t->rightmost == p) t->rightmost = q;
+  node_pool_t *pool = rbtree_pool(t);               // 할당/반환 counter에는 세지 않음
+  if (pool->free_list == NULL) pool->free_tail = p;
+  p->right = pool->free_list;
+  pool->free_list = p;
+  pool->free_count++;
+  return q;
+}
+
+// 배치 범위 안에서 p 서브트리의 높이를 반환하는 메서드
+static int rbtree_compact_height(const rbtree_compactor *c, const node_t *p) {
+  if (!rbtree_compact_inside(c, p)) return 0;
+  const int l = rbtree_compact_height(c, p->left), r = rbtree_compact_height(c, p->right);
+  return 1 + (l > r ? l : r);
+}
+
+static void rbtree_compact_below(rbtree_compactor *c, node_t *p, int depth, int d);
+
+// p부터 d단계를 vEB 순서로 옮기고 p의 새 주소를 반환하는 메서드
+static node_t *rbtree_compact_veb(rbtree_compactor *c, node_t *p, int d) {
+  if (!rbtree_compact_inside(c, p)) return p;
+  if (d == 1) return rbtree_compact_move(c, p);
+  const int top = d / 2;
+  p = rbtree_compact_veb(c, p, top);                // 위쪽 절반을 먼저
+  rbtree_compact_below(c, p, top, d - top);         // 그 아래 서브트리들을 왼쪽부터 차례로
+  return p;
+}
+
+// p에서 depth단계 아래의 노드마다 d단계를 vEB 순서로 옮기는 메서드
+static void rbtree_compact_below(rbtree_compactor *c, node_t *p, int depth, int d) {
+  if (!rbtree_compact_inside(c, p)) return;
+  if (depth == 0) {
+    rbtree_compact_veb(c, p, d);
+    return;
+  }
+  rbtree_compact_below(c, p->left, depth - 1, d);   // p는 이미 옮겼으므로 p->right는 왼쪽을 옮긴 뒤에 읽어도 됨
+  rbtree_compact_below(c, p->right, depth - 1, d);
+}
+
+static int rbtree_chunk_cmp(const void *a, const void *b) {
+  const uintptr_t x = (uintptr_t)*(node_chunk_t *const *)a, y = (uintptr_t)*(node_chunk_t *const *)b;
+  return x < y ? -1 : x > y;
+}
+
+// 주소 순서로 정렬된 chunk 중 p가 속한 chunk의 위치를 반환하는 메서드
+static size_t rbtree_chunk_find(node_chunk_t **sorted, size_t m, const node_t *p) {
+  size_t lo = 0;
+  while (m > 1) {                                   // nodes가 p 이하인 마지막 chunk
+    const size_t half = m / 2;
+    if ((uintptr_t)sorted[lo + half]->nodes <= (uintptr_t)p) lo += half;
+    m -= half;
+  }
+  return lo;
+}
+
+// 모든 노드가 free list에 있는 chunk를 반환하는 메서드 (free list 길이 f, chunk 수 m에 대해 O(f log m))
+static void rbtree_pool_shrink(node_pool_t *pool) {
+  size_t m = 0, empty = 0;
+  for (node_chunk_t *c = pool->chunks; c != NULL; c = c->next) m++;
+  if (m == 0) return;
+  node_chunk_t **sorted = (node_chunk_t **)malloc(m * sizeof(node_chunk_t *));
+  size_t *cnt = (size_t *)calloc(m, sizeof(size_t));
+  if (sorted == NULL || cnt == NULL) {              // 반환하지 못해도 tree에는 문제 없음
+    free(sorted);
+    free(cnt);
+    return;
+  }
+  m = 0;
+  for (node_chunk_t *c = pool->chunks; c != NULL; c = c->next) sorted[m++] = c;
+  qsort(sorted, m, sizeof(node_chunk_t *), rbtree_chunk_cmp);
+  for (node_t *p = pool->free_list; p != NULL; p = p->right) cnt[rbtree_chunk_find(sorted, m, p)]++;
+  for (size_t i = 0; i < m; i++)
+    if (cnt[i] == sorted[i]->cap) {
+      cnt[i] = SIZE_MAX;                            // 반환할 chunk 표시
+      empty++;
+    }
+  if (empty > 0) {
+    node_t *head = NULL, **link = &head;           // 남는 chunk의 노드만 원래 순서대로 다시 이음
+    pool->free_tail = NULL;
+    pool->free_count = 0;
+    for (node_t *p = pool->free_list, *next; p != NULL; p = next) {
+      next = p->right;
+      if (cnt[rbtree_chunk_find(sorted, m, p)] == SIZE_MAX) continue;
+      *link = pool->free_tail = p;
+      link = &p->right;
+      pool->free_count++;
+    }
+    *link = NULL;
+    pool->free_list = head;
+    node_chunk_t **cl = &pool->chunks;
+    pool->last_chunk = NULL;
+    while (*cl != NULL) {
+      node_chunk_t *c = *cl;
+      if (cnt[rbtree_chunk_find(sorted, m, c->nodes)] == SIZE_MAX) {
+        *cl = c->next;
+        free(c);
+      } else {
+        pool->last_chunk = c;
+        cl = &c->next;
+      }
+    }
+  }
+  free(sorted);
+  free(cnt);
+}
+
+// t의 노드를 step마다 slice개 안팎씩 옮기는 재배치를 시작하는 메서드 (옮겨 갈 chunk만 할당)
+rbtree_compactor *rbtree_compact_begin(rbtree *t, const size_t slice) {
+  if (t == NULL || slice == 0) return NULL;
+  rbtree_compactor *c = (rbtree_compactor *)calloc(1, sizeof(rbtree_compactor));
+  if (c == NULL) return NULL;
+  node_pool_t *pool = rbtree_pool(t);
+  size_t n = t->root->size;                         // 노드 수 (RBTREE_COUNTED면 key 수와 다르므로 따로 셈)
+#ifdef RBTREE_COUNTED
+  if (pool->refs == 1) {                            // pool을 혼자 쓰면 pool에서 쓰고 있는 노드 수
+    size_t total = 0;
+    for (node_chunk_t *k = pool->chunks; k != NULL; k = k->next) total += k->cap;
+    n = total - pool->free_count;
+  } else {                                          // 다른 tree와 나눠 쓰면 노드를 직접 셈 (O(n))
+    n = 0;
+    for (node_t *p = t->leftmost; p != NULL && p != t->nil; p = rbtree_next(t, p)) n++;
+  }
+#endif
+  c->t = t;
+  c->slice = slice;
+  size_t root = 1;
+  while (root < n / root) root *= 2;                // √n 이상인 2의 거듭제곱
+  c->block = slice > root ? slice : root;           // 위쪽 노드는 O(n / block)개이므로 첫 step도 O(slice + √n)
+  if (n == 0) c->done = 1;
+  else if ((c->dst = rbtree_chunk_new(pool, n)) == NULL) {
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+// 다음 slice를 옮기고 남은 노드가 있으면 1을 반환하는 메서드
+// 서브트리 단위로 옮기므로 한 step에서 slice + block개 미만을 옮기며, 첫 step은 위쪽 노드도 옮김
+// step 사이에 tree를 바꿔도 되며, 그동안 새로 생긴 노드는 옮기지 않고 남겨 둠
+int rbtree_compact_step(rbtree_compactor *c) {
+  if (c == NULL || c->done) return 0;
+  rbtree *t = c->t;
+  const size_t start = c->used;
+  node_t *p;
+  size_t rank;                                      // p의 첫 key의 순위
+  if (!c->top_done) {
+    c->limit = c->block;
+    rbtree_compact_veb(c, t->root, rbtree_compact_height(c, t->root));
+    c->top_done = 1;
+    p = t->root == t->nil ? NULL : t->leftmost;
+    rank = 0;
+  } else {
+    p = rbtree_select(t, c->rank);                  // 같은 key가 길게 이어져도 옮긴 노드를 다시 훑지 않음
+    rank = c->rank;
+#ifdef RBTREE_COUNTED
+    if (p != NULL) rank = rbtree_rank(t, p->key);   // step 사이에 바뀌어 노드 중간을 가리키면 노드의 첫 key로
+#endif
+  }
+  c->limit = 0;
+  while (p != NULL && c->used - start < c->slice && c->used < c->dst->cap) {
+    if (p->size > c->block) {                       // 위쪽 노드는 첫 step에서 옮겼음
+      rank += rb_count(p);
+      p = rbtree_next(t, p);
+      continue;
+    }
+    node_t *r = p;                                  // p를 포함하는 크기 block 이하의 가장 큰 서브트리
+    size_t before = p->left->size;                  // r 안에서 p보다 앞선 key 수
+    while (rb_parent(r) != t->nil && rb_parent(r)->size <= c->block) {
+      if (r == rb_parent(r)->right) before += rb_parent(r)->left->size + rb_count(rb_parent(r));
+      r = rb_parent(r);
+    }
+    if (!rbtree_compact_placed(c, r)) r = rbtree_compact_veb(c, r, rbtree_compact_height(c, r));
+    rank += r->size - before;
+    while (r->right != t->nil) r = r->right;
+    p = rbtree_next(t, r);
+  }
+  c->rank = rank;
+  c->done = p == NULL || c->used == c->dst->cap;
+  return !c->done;
+}
+
+// 재배치를 끝내는 메서드 (dst의 남은 자리는 free list로, 모든 노드가 비게 된 chunk는 반환)
+void rbtree_compact_end(rbtree_compactor *c) {
+  if (c == NULL) return;
+  if (c->dst != NULL) {
+    node_pool_t *pool = rbtree_pool(c->t);
+    for (size_t i = c->dst->cap; i > c->used; i--) {  // 주소 순서대로 꺼내지도록 뒤에서부터 연결
+      node_t *p = &c->dst->nodes[i - 1];
+      if (pool->free_list == NULL) pool->free_tail = p;
+      p->right = pool->free_list;
+      pool->free_list = p;
+      pool->free_count++;
+    }
+    rbtree_pool_shrink(pool);
+  }
+  free(c);
+}
+
+// 모든 노드를 한 번에 재배치하는 메서드 (성공하면 0)
+int rbtree_compact(rbtree *t) {
+  rbtree_compactor *c = rbtree_compact_begin(t, SIZE_MAX);
+  if (c == NULL) return 1;
+  while (rbtree_compact_step(c));
+  rbtree_compact_end(c);
+  return 0;
+}
@@ -2,31 +2,296 @@
 #define _RBTREE_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
-typedef enum { RBTREE_RED, RBTREE_BLACK } color_t;
+typedef enum { RBTREE_RED, RBTREE_BLACK } color_t;  // RED = 0, BLACK = 1 (RBTREE_COMPACT에서 1비트로 저장)
 
 typedef int key_t;
 
+#ifdef RBTREE_COMPACT
+// color를 parent 포인터의 최하위 비트에 저장하는 layout
+// (node는 포인터 크기로 정렬되므로 최하위 비트는 항상 0, 서브트리 크기는 32비트로 제한)
+typedef struct node_t {
+  uintptr_t parent_color;
+  struct node_t *left, *right;
+  key_t key;
+  unsigned int size;  // 이 노드를 루트로 하는 서브트리의 key 수 (nil은 0)
+#ifdef RBTREE_COUNTED
+  unsigned int count;  // 이 노드에 모인 같은 key의 수
+#endif
+#ifdef RBTREE_INTERVAL
+  key_t end;      // 구간 [key, end]의 끝
+  key_t max_end;  // 이 노드를 루트로 하는 서브트리의 가장 큰 end (nil은 사용하지 않음)
+#endif
+} node_t;
+
+#define rb_parent(n) ((node_t *)((n)->parent_color & ~(uintptr_t)1))
+#define rb_color(n) ((color_t)((n)->parent_color & 1))
+#define rb_set_parent(n, p) ((n)->parent_color = (uintptr_t)(p) | ((n)->parent_color & 1))
+#define rb_set_color(n, c) ((n)->parent_color = ((n)->parent_color & ~(uintptr_t)1) | (uintptr_t)(c))
+#else
 typedef struct node_t {
   color_t color;
   key_t key;
   struct node_t *parent, *left, *right;
+  size_t size;  // 이 노드를 루트로 하는 서브트리의 key 수 (nil은 0)
+#ifdef RBTREE_COUNTED
+  unsigned int count;  // 이 노드에 모인 같은 key의 수
+#endif
+#ifdef RBTREE_INTERVAL
+  key_t end;      // 구간 [key, end]의 끝
+  key_t max_end;  // 이 노드를 루트로 하는 서브트리의 가장 큰 end (nil은 사용하지 않음)
+#endif
 } node_t;
 
+#define rb_parent(n) ((n)->parent)
+#define rb_color(n) ((n)->color)
+#define rb_set_parent(n, p) ((n)->parent = (p))
+#define rb_set_color(n, c) ((n)->color = (c))
+#endif
+
+// RBTREE_COUNTED: 같은 key를 노드 하나에 모아 개수로 저장하는 multiset
+// 삽입은 같은 key의 노드가 있으면 개수만 늘리고, 삭제는 개수를 줄이다 0이 되면 노드를 반환
+#ifdef RBTREE_COUNTED
+#define rb_count(n) ((n)->count)
+#else
+#define rb_count(n) 1
+#endif
+
+// RBTREE_INTERVAL: 노드마다 구간 [key, end]를 저장하고 서브트리의 가장 큰 end를 유지하는 interval tree
+// rbtree_insert 등 key만 받는 연산은 점 구간 [key, key]를 넣음 (끄면 모든 노드가 점 구간)
+#ifdef RBTREE_INTERVAL
+#ifdef RBTREE_COUNTED
+#error "RBTREE_INTERVAL은 같은 key를 노드 하나에 모으는 RBTREE_COUNTED와 함께 쓸 수 없음"
+#endif
+#define rb_end(n) ((n)->end)
+#else
+#define rb_end(n) ((n)->key)
+#endif
+
+struct node_pool_t;
+
+// RBTREE_STATS로 빌드하면 tree마다 연산 횟수를 셈 (끄면 counter와 세는 코드가 모두 빠짐)
+// 비교 횟수는 insert/insert_hint/find/find_batch/lower_bound/upper_bound의 탐색 단계 수
+typedef struct {
+  uint64_t comparisons;
+  uint64_t rotations;
+  uint64_t insert_fixups;  // rbtree_insert_fixup의 loop 반복 수
+  uint64_t erase_fixups;   // rbtree_erase_fixup의 loop 반복 수
+  uint64_t allocs, frees;  // free list에서 꺼내고 되돌린 노드 수
+} rbtree_counters_t;
+
 typedef struct {
   node_t *root;
-  node_t *nil;  // for sentinel
+  node_t *nil;  // for sentinel (모든 tree가 공유하는 읽기 전용 노드)
+  struct node_pool_t *pool;  // 노드를 잘라 쓰는 slab chunk와 free list (split/join한 tree끼리 공유)
+  node_t *leftmost, *rightmost;  // 최솟값, 최댓값 노드 (비어 있으면 nil)
+#ifdef RBTREE_STATS
+  rbtree_counters_t counters;
+#endif
 } rbtree;
 
 rbtree *new_rbtree(void);
 void delete_rbtree(rbtree *);
+int rbtree_reserve(rbtree *, const size_t);
+size_t rbtree_memory(const rbtree *);
+rbtree *rbtree_from_sorted(const key_t *, const size_t);
+rbtree *rbtree_from_array(const key_t *, const size_t);
+int rbtree_assign_sorted(rbtree *, const key_t *, const size_t);
+void rbtree_clear(rbtree *);
+
+// 노드를 재할당하지 않고 옮기는 O(log n) 연산
+// join: t1의 모든 key <= t2의 모든 key일 때 t2의 노드를 t1으로 옮김 (t2는 빈 tree로 남음)
+// split: key 미만은 *lo, 이상은 *hi인 새 tree로 옮김 (t는 빈 tree로 남음)
+int rbtree_join(rbtree *, rbtree *);
+int rbtree_split(rbtree *, const key_t, rbtree **, rbtree **);
+
+// 집합 연산: t1을 결과로 바꾸고 t2는 빈 tree로 남김 (O(m log(n/m + 1)), 큰 입력은 여러 thread로 나눠 수행)
+// 같은 key의 개수는 union이면 큰 쪽, intersection이면 작은 쪽, difference이면 t1 - t2 (0 미만은 0)
+int rbtree_union(rbtree *, rbtree *);
+int rbtree_intersection(rbtree *, rbtree *);
+int rbtree_difference(rbtree *, rbtree *);
 
 node_t *rbtree_insert(rbtree *, const key_t);
+#ifdef RBTREE_INTERVAL
+node_t *rbtree_insert_interval(rbtree *, const key_t, const key_t);  // 구간 [lo, hi]를 삽입 (hi < lo이면 NULL)
+#endif
+node_t *rbtree_insert_hint(rbtree *, node_t *, const key_t);
 node_t *rbtree_find(const rbtree *, const key_t);
+size_t rbtree_find_batch(const rbtree *, const key_t *, const size_t, node_t **);
 node_t *rbtree_min(const rbtree *);
 node_t *rbtree_max(const rbtree *);
 int rbtree_erase(rbtree *, node_t *);
+size_t rbtree_erase_range(rbtree *, const key_t, const key_t);
+
+// 우선순위 큐 연산: 꺼낸 key를 out에 쓰고 꺼낸 key 수를 반환 (비어 있으면 0)
+int rbtree_pop_min(rbtree *, key_t *);
+int rbtree_pop_max(rbtree *, key_t *);
+size_t rbtree_pop_min_n(rbtree *, key_t *, const size_t);
 
+// 큰 tree는 서브트리 크기로 각 부분의 출력 위치를 정해 여러 thread가 나눠 씀
 int rbtree_to_array(const rbtree *, key_t *, const size_t);
 
+// 전체 배열 대신 cap개짜리 buffer를 채울 때마다 flush(buf, len, arg)를 호출 (0이 아닌 값을 반환하면 멈춤)
+typedef int (*rbtree_flush_t)(const key_t *, size_t, void *);
+size_t rbtree_to_array_stream(const rbtree *, key_t *, const size_t, rbtree_flush_t, void *);
+
+size_t rbtree_size(const rbtree *);
+node_t *rbtree_select(const rbtree *, const size_t);
+size_t rbtree_rank(const rbtree *, const key_t);
+
+// 구조 통계 (O(n) 순회) 와 연산 counter (RBTREE_STATS가 아니면 0)
+#define RBTREE_STATS_MAX_DEPTH 128
+
+typedef struct {
+  rbtree_counters_t counters;
+  size_t nodes;         // 노드 수 (RBTREE_COUNTED에서는 서로 다른 key 수)
+  size_t keys;          // key 수 (rbtree_size)
+  int height;           // 루트부터 가장 깊은 노드까지의 노드 수
+  int black_height;     // 루트부터 nil까지의 BLACK 노드 수 (nil 제외)
+  size_t depth_hist[RBTREE_STATS_MAX_DEPTH];  // 깊이(루트 = 0)별 노드 수
+} rbtree_stats_t;
+
+void rbtree_stats(const rbtree *, rbtree_stats_t *);
+void rbtree_stats_reset(rbtree *);
+
+// 순회: 끝에 도달하면 NULL을 반환
+node_t *rbtree_next(const rbtree *, const node_t *);
+node_t *rbtree_prev(const rbtree *, const node_t *);
+node_t *rbtree_lower_bound(const rbtree *, const key_t);
+node_t *rbtree_upper_bound(const rbtree *, const key_t);
+
+// range scan 콜백: 0이 아닌 값을 반환하면 scan을 멈춤
+typedef int (*rbtree_visit_t)(node_t *, void *);
+size_t rbtree_range_scan(const rbtree *, const key_t, const key_t, rbtree_visit_t, void *);
+
+// 구간 [lo, hi]와 겹치는(key <= hi이고 end >= lo인) 노드를 key 순서대로 방문하고 방문한 key 수를 반환
+// RBTREE_INTERVAL이면 max_end로 겹칠 수 없는 서브트리를 건너뛰어 결과가 있는 경로만 내려감
+// (O((k + 1) log n), 결과가 key 순서로 모여 있으면 O(log n + k), 끄면 항상 O(log n + k))
+size_t rbtree_overlaps(const rbtree *, const key_t, const key_t, rbtree_visit_t, void *);
+
+// 노드 재배치: 삽입/삭제로 흩어진 노드를 새 chunk 하나에 탐색 경로가 가깝도록 van Emde Boas 순서로 옮기고
+// 노드가 모두 빠진 chunk를 반환함 (nil은 옮기지 않음, 옮긴 노드의 주소가 바뀌므로 caller의 node pointer는 무효가 됨)
+// rbtree_compact는 한 번에 수행하고, begin/step/end는 step마다 slice개 안팎씩 나눠 수행함 (step은 남은 노드가 있으면 1)
+// step 사이에는 tree를 조회하거나 바꿔도 되며, 그 사이 새로 생긴 노드는 옮기지 않음 (tree를 삭제하기 전에 end 호출)
+typedef struct rbtree_compactor rbtree_compactor;
+
+int rbtree_compact(rbtree *);
+rbtree_compactor *rbtree_compact_begin(rbtree *, const size_t);
+int rbtree_compact_step(rbtree_compactor *);
+void rbtree_compact_end(rbtree_compactor *);
+
+// 읽기 전용 snapshot (rbtree_frozen.c)
+// level[0]은 정렬된 전체 key, level[i + 1]은 level[i]의 16개짜리 block마다 최댓값을 모은 것
+#define RBTREE_FROZEN_BLOCK 16
+#define RBTREE_FROZEN_MAX_LEVEL 16
+
+typedef struct {
+  size_t n;
+  int height;
+  key_t *level[RBTREE_FROZEN_MAX_LEVEL];
+  size_t len[RBTREE_FROZEN_MAX_LEVEL];
+  key_t *mem;
+} rbtree_frozen;
+
+rbtree_frozen *rbtree_freeze(const rbtree *);
+void delete_rbtree_frozen(rbtree_frozen *);
+size_t rbtree_frozen_lower_bound(const rbtree_frozen *, const key_t);
+size_t rbtree_frozen_upper_bound(const rbtree_frozen *, const key_t);
+const key_t *rbtree_frozen_find(const rbtree_frozen *, const key_t);
+const key_t *rbtree_frozen_range(const rbtree_frozen *, const key_t, const key_t, size_t *);
+
+// 파일 저장/불러오기 (rbtree_io.c): 성공하면 save는 0, load는 새 tree를 반환
+// header 뒤에 정렬된 key를 그대로 이어 쓴 형식이므로 불러올 때 mmap한 key 배열로 O(n)에 tree를 만듦
+// RBTREE_COUNTED는 같은 key를 개수만큼 펼쳐서 저장하므로 layout과 관계없이 같은 파일을 읽을 수 있음
+// RBTREE_INTERVAL에서 점 구간이 아닌 노드가 있으면 저장하지 않음 (파일에는 key만 들어감)
+#define RBTREE_FILE_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t key_size;  // sizeof(key_t)
+  uint32_t reserved;
+  uint64_t count;     // key 수
+  uint64_t checksum;  // key 배열의 FNV-1a
+} rbtree_file_header_t;
+
+int rbtree_save(const rbtree *, const char *);
+rbtree *rbtree_load(const char *);
+
+// 변경 log (rbtree_io.c): snapshot 이후의 삽입/삭제를 log 파일에 덧붙이고, 열 때 snapshot 위에 다시 적용
+// 기록은 sync_bytes byte가 모이거나 sync_ms ms가 지날 때 한 번의 fsync로 묶어서 수행 (group commit, 0이면 해당 기준을 쓰지 않음)
+// 따라서 insert/erase가 반환된 뒤에도 다음 group commit 전에 멈추면 그 사이의 변경은 잃을 수 있음
+typedef struct rbtree_wal rbtree_wal;
+
+typedef struct {
+  uint64_t records;      // 기록한 변경 수
+  uint64_t bytes;        // log에 쓴 byte 수
+  uint64_t syncs;        // group commit(fsync) 수
+  uint64_t checkpoints;
+  uint64_t replayed;     // 열 때 다시 적용한 변경 수
+} rbtree_wal_stats_t;
+
+rbtree_wal *rbtree_wal_open(const char *, const char *, const size_t, const unsigned int);
+void delete_rbtree_wal(rbtree_wal *);
+rbtree *rbtree_wal_tree(rbtree_wal *);
+node_t *rbtree_wal_insert(rbtree_wal *, const key_t);
+int rbtree_wal_erase(rbtree_wal *, node_t *);
+int rbtree_wal_sync(rbtree_wal *);
+int rbtree_wal_checkpoint(rbtree_wal *);
+void rbtree_wal_stats(rbtree_wal *, rbtree_wal_stats_t *);
+
+// 변경할 때 경로의 노드만 복사해 이전 버전을 남기는 tree (rbtree_persistent.c)
+// rbtree_snapshot은 O(1)에 현재 버전을 고정하고, 고정된 버전은 writer가 계속 바꾸는 동안에도 lock 없이 읽음
+// 버전끼리 바뀌지 않은 서브트리를 공유하며, 노드는 참조하는 마지막 버전이 release될 때 반환됨
+// snapshot이 없으면 복사하지 않고 제자리에서 고침 (같은 key는 중복 저장, RBTREE_COUNTED와 관계없음)
+typedef struct rbtree_persistent rbtree_persistent;
+typedef struct rbtree_version rbtree_version;
+
+rbtree_persistent *new_rbtree_persistent(void);
+void delete_rbtree_persistent(rbtree_persistent *);
+int rbtree_persistent_insert(rbtree_persistent *, const key_t);
+int rbtree_persistent_erase(rbtree_persistent *, const key_t);
+size_t rbtree_persistent_size(rbtree_persistent *);
+rbtree_version *rbtree_snapshot(rbtree_persistent *);
+void rbtree_snapshot_release(rbtree_version *);
+size_t rbtree_version_size(const rbtree_version *);
+int rbtree_version_find(const rbtree_version *, const key_t);
+int rbtree_version_lower_bound(const rbtree_version *, const key_t, key_t *);
+int rbtree_version_min(const rbtree_version *, key_t *);
+int rbtree_version_max(const rbtree_version *, key_t *);
+int rbtree_version_to_array(const rbtree_version *, key_t *, const size_t);
+
+// 여러 thread가 공유하는 tree (rbtree_mt.c)
+// 조회(find/min/max)는 seqlock으로 lock 없이 수행되어 reader끼리 서로 막지 않음
+// node pointer는 다른 thread의 삭제로 무효가 될 수 있으므로 key 단위로 다룸
+typedef struct rbtree_mt rbtree_mt;
+
+rbtree_mt *new_rbtree_mt(void);
+void delete_rbtree_mt(rbtree_mt *);
+int rbtree_mt_insert(rbtree_mt *, const key_t);
+int rbtree_mt_erase(rbtree_mt *, const key_t);
+int rbtree_mt_find(rbtree_mt *, const key_t);
+int rbtree_mt_min(rbtree_mt *, key_t *);
+int rbtree_mt_max(rbtree_mt *, key_t *);
+size_t rbtree_mt_range_scan(rbtree_mt *, const key_t, const key_t, rbtree_visit_t, void *);
+int rbtree_mt_to_array(rbtree_mt *, key_t *, const size_t);
+size_t rbtree_mt_size(rbtree_mt *);
+
+// key 범위로 나눈 여러 개의 rbtree_mt (rbtree_mt.c)
+// 서로 다른 shard에 대한 쓰기는 병렬로 진행되며, 전체 연산은 shard를 key 순서대로 이어 붙여 수행
+typedef struct rbtree_sharded rbtree_sharded;
+
+rbtree_sharded *new_rbtree_sharded(const size_t, const key_t *);
+void delete_rbtree_sharded(rbtree_sharded *);
+int rbtree_sharded_rebalance(rbtree_sharded *, const key_t *, const size_t);
+int rbtree_sharded_insert(rbtree_sharded *, const key_t);
+int rbtree_sharded_erase(rbtree_sharded *, const key_t);
+int rbtree_sharded_find(rbtree_sharded *, const key_t);
+int rbtree_sharded_min(rbtree_sharded *, key_t *);
+int rbtree_sharded_max(rbtree_sharded *, key_t *);
+size_t rbtree_sharded_range_scan(rbtree_sharded *, const key_t, const key_t, rbtree_visit_t, void *);
+int rbtree_sharded_to_array(rbtree_sharded *, key_t *, const size_t);
+size_t rbtree_sharded_size(rbtree_sharded *);
+
 #endif  // _RBTREE_H_
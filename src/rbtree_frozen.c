@@ -0,0 +1,132 @@
+#include "rbtree.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define RBTREE_KEY_MAX INT_MAX
+
+size_t rbtree_frozen_search(const rbtree_frozen *f, const key_t key, int upper);
+int rbtree_frozen_block_rank(const key_t *blk, const key_t key, int upper);
+
+static size_t round_block(size_t n) {
+  return (n + RBTREE_FROZEN_BLOCK - 1) / RBTREE_FROZEN_BLOCK * RBTREE_FROZEN_BLOCK;
+}
+
+rbtree_frozen *rbtree_freeze(const rbtree *t) {
+  if (t == NULL) return NULL;
+  rbtree_frozen *f = (rbtree_frozen *)calloc(1, sizeof(rbtree_frozen));
+  if (f == NULL) return NULL;
+  f->n = rbtree_size(t);
+
+  // 각 level의 길이를 먼저 계산해 모든 level을 하나의 정렬된 영역에 할당
+  size_t len = f->n, total = 0;
+  do {
+    if (f->height == RBTREE_FROZEN_MAX_LEVEL) {
+      free(f);
+      return NULL;
+    }
+    f->len[f->height++] = len;
+    total += round_block(len > 0 ? len : 1);
+    len = (len + RBTREE_FROZEN_BLOCK - 1) / RBTREE_FROZEN_BLOCK;
+  } while (f->len[f->height - 1] > RBTREE_FROZEN_BLOCK);
+
+  f->mem = (key_t *)aligned_alloc(64, total * sizeof(key_t));
+  if (f->mem == NULL) {
+    free(f);
+    return NULL;
+  }
+  key_t *cur = f->mem;
+  for (int l = 0; l < f->height; l++) {
+    f->level[l] = cur;
+    cur += round_block(f->len[l] > 0 ? f->len[l] : 1);
+  }
+
+  if (f->n > 0) rbtree_to_array(t, f->level[0], f->n);
+  for (int l = 0; l < f->height; l++) {
+    key_t *lv = f->level[l];
+    size_t padded = round_block(f->len[l] > 0 ? f->len[l] : 1);
+    for (size_t i = f->len[l]; i < padded; i++) lv[i] = RBTREE_KEY_MAX;  // 남는 칸은 최댓값으로 채움
+    if (l + 1 == f->height) break;
+    for (size_t b = 0; b < f->len[l + 1]; b++)      // 위 level에는 block마다 마지막(최대) key를 올림
+      f->level[l + 1][b] = lv[(b + 1) * RBTREE_FROZEN_BLOCK - 1];
+  }
+  return f;
+}
+
+void delete_rbtree_frozen(rbtree_frozen *f) {
+  if (f != NULL) {
+    free(f->mem);
+    free(f);
+  }
+}
+
+// block(16개)에서 key보다 작은 (upper면 key 이하인) 원소의 수를 세는 메서드
+int rbtree_frozen_block_rank(const key_t *blk, const key_t key, int upper) {
+#if defined(__AVX2__)
+  __m256i x = _mm256_set1_epi32(key);
+  __m256i a = _mm256_load_si256((const __m256i *)blk);
+  __m256i b = _mm256_load_si256((const __m256i *)(blk + 8));
+  if (upper) {                                      // key 이하 = 16 - (key 초과)
+    int gt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, x))) |
+             _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, x))) << 8;
+    return RBTREE_FROZEN_BLOCK - __builtin_popcount(gt);
+  }
+  int lt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, a))) |
+           _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, b))) << 8;
+  return __builtin_popcount(lt);
+#elif defined(__SSE2__)
+  __m128i x = _mm_set1_epi32(key);
+  int mask = 0;
+  for (int i = 0; i < RBTREE_FROZEN_BLOCK; i += 4) {
+    __m128i v = _mm_load_si128((const __m128i *)(blk + i));
+    __m128i c = upper ? _mm_cmpgt_epi32(v, x) : _mm_cmpgt_epi32(x, v);
+    mask |= _mm_movemask_ps(_mm_castsi128_ps(c)) << i;
+  }
+  return upper ? RBTREE_FROZEN_BLOCK - __builtin_popcount(mask) : __builtin_popcount(mask);
+#else
+  int cnt = 0;
+  for (int i = 0; i < RBTREE_FROZEN_BLOCK; i++) cnt += upper ? blk[i] <= key : blk[i] < key;
+  return cnt;
+#endif
+}
+
+// 위 level부터 block 하나씩 내려가며 level[0]에서의 위치를 찾는 메서드
+size_t rbtree_frozen_search(const rbtree_frozen *f, const key_t key, int upper) {
+  if (f == NULL || f->n == 0) return 0;
+  size_t idx = 0;                                   // 현재 level에서 살펴볼 block 번호
+  for (int l = f->height - 1; l >= 0; l--) {
+    const key_t *blk = f->level[l] + idx * RBTREE_FROZEN_BLOCK;
+    idx = idx * RBTREE_FROZEN_BLOCK + rbtree_frozen_block_rank(blk, key, upper);
+    if (idx >= f->len[l]) return f->n;              // 모든 key가 조건을 만족하지 않음
+  }
+  return idx;
+}
+
+// key 이상인 첫 key의 위치 (없으면 n)
+size_t rbtree_frozen_lower_bound(const rbtree_frozen *f, const key_t key) {
+  return rbtree_frozen_search(f, key, 0);
+}
+
+// key보다 큰 첫 key의 위치 (없으면 n)
+size_t rbtree_frozen_upper_bound(const rbtree_frozen *f, const key_t key) {
+  return rbtree_frozen_search(f, key, 1);
+}
+
+const key_t *rbtree_frozen_find(const rbtree_frozen *f, const key_t key) {
+  size_t i = rbtree_frozen_lower_bound(f, key);
+  if (f == NULL || i >= f->n || f->level[0][i] != key) return NULL;
+  return &f->level[0][i];
+}
+
+// [lo, hi) 구간의 key는 연속으로 저장되므로 첫 key의 위치와 개수를 반환
+const key_t *rbtree_frozen_range(const rbtree_frozen *f, const key_t lo, const key_t hi, size_t *cnt) {
+  size_t first = rbtree_frozen_lower_bound(f, lo);
+  size_t last = lo < hi ? rbtree_frozen_lower_bound(f, hi) : first;
+  if (cnt != NULL) *cnt = last - first;
+  if (f == NULL || first == last) return NULL;
+  return &f->level[0][first];
+}
@@ -0,0 +1,471 @@
+#ifndef _RBTREE_GEN_H_
+#define _RBTREE_GEN_H_
+
+#include <stddef.h>
+#include <stdlib.h>
+
+// key/value 타입과 비교 연산을 컴파일 시간에 정하는 RB 트리 생성기
+//
+//   #define PRICE_LESS(a, b) ((a) < (b))
+//   RBTREE_GENERATE(price_map, uint64_t, order_t, PRICE_LESS)
+//
+// 위 선언은 price_map 트리와 price_map_node 노드 타입, price_map_insert(t, key, value) 등의
+// static inline 함수를 만든다. less(a, b)는 a < b일 때 참인 식으로, 함수 포인터 없이 그대로 펼쳐진다.
+// key와 value는 노드 안에 함께 저장되므로 값을 찾으려고 다른 자료구조를 한 번 더 조회할 필요가 없다.
+// 같은 key는 rbtree_insert와 마찬가지로 중복 삽입되며, 노드는 rbtree와 같은 방식의 slab에서 할당된다.
+// 노드는 rbtree_link를 품고 있어 회전과 재조정은 아래 침입형 트리의 rbtree_intrusive_* 함수를 그대로 쓰며,
+// 매크로는 key 비교(삽입/탐색)와 노드 할당만 타입별로 만든다.
+
+#define RBTREE_GEN_RED 0
+#define RBTREE_GEN_BLACK 1
+#define RBTREE_GEN_CHUNK_MIN 64
+#define RBTREE_GEN_CHUNK_MAX 8192
+
+// 기본 비교 연산 (산술 타입용)
+#define RBTREE_LESS(a, b) ((a) < (b))
+
+// 침입형(intrusive) 트리: caller의 구조체에 rbtree_link를 넣고 그 구조체를 직접 연결
+//
+//   typedef struct order { uint64_t id; int price; rbtree_link by_id, by_price; } order_t;
+//   #define ORDER_ID(o) ((o)->id)
+//   #define ORDER_PRICE(o) ((o)->price)
+//   RBTREE_GENERATE_INTRUSIVE(order_by_id, order_t, by_id, uint64_t, ORDER_ID, RBTREE_LESS)
+//   RBTREE_GENERATE_INTRUSIVE(order_by_price, order_t, by_price, int, ORDER_PRICE, RBTREE_LESS)
+//
+// 트리는 노드를 할당하지 않으므로 삽입이 실패하지 않고, key를 복사하지 않으며,
+// 구조체마다 link를 여러 개 두면 한 객체가 여러 트리에 동시에 들어갈 수 있다.
+// key_of(obj)는 const T *에서 key를 꺼내는 식이고, 트리에 들어 있는 동안 key를 바꾸면 안 된다.
+// 회전과 재조정은 key와 관계없는 아래 rbtree_intrusive_* 함수를 모든 트리가 함께 쓰고,
+// 매크로는 key를 비교하는 삽입/탐색과 link에서 객체로 돌아가는 함수만 만든다.
+
+typedef struct rbtree_link {
+  struct rbtree_link *parent, *left, *right;
+  unsigned char color;
+} rbtree_link;
+
+// nil이 자기 안의 nil_node를 가리키므로 초기화한 뒤에는 복사하거나 옮기면 안 됨
+typedef struct {
+  rbtree_link *root;
+  rbtree_link *nil;
+  size_t size;
+  rbtree_link nil_node;
+} rbtree_intrusive;
+
+// link가 들어 있는 T 객체의 pointer (link가 NULL이면 NULL)
+#define RBTREE_ENTRY(link, T, field) ((link) == NULL ? (T *)NULL : (T *)((char *)(link) - offsetof(T, field)))
+
+static inline void rbtree_intrusive_init(rbtree_intrusive *t) {
+  t->nil = &t->nil_node;
+  t->nil->parent = t->nil->left = t->nil->right = t->nil;
+  t->nil->color = RBTREE_GEN_BLACK;
+  t->root = t->nil;
+  t->size = 0;
+}
+
+static inline void rbtree_intrusive_rotate_left(rbtree_intrusive *t, rbtree_link *x) {
+  rbtree_link *y = x->right;
+  x->right = y->left;
+  if (y->left != t->nil) y->left->parent = x;
+  y->parent = x->parent;
+  if (x->parent == t->nil) t->root = y;
+  else if (x == x->parent->left) x->parent->left = y;
+  else x->parent->right = y;
+  y->left = x;
+  x->parent = y;
+}
+
+static inline void rbtree_intrusive_rotate_right(rbtree_intrusive *t, rbtree_link *y) {
+  rbtree_link *x = y->left;
+  y->left = x->right;
+  if (x->right != t->nil) x->right->parent = y;
+  x->parent = y->parent;
+  if (y->parent == t->nil) t->root = x;
+  else if (y == y->parent->right) y->parent->right = x;
+  else y->parent->left = x;
+  x->right = y;
+  y->parent = x;
+}
+
+// n을 parent의 왼쪽(left가 참) 또는 오른쪽 자식으로 붙이고 재조정하는 함수 (parent가 nil이면 루트)
+static inline void rbtree_intrusive_link(rbtree_intrusive *t, rbtree_link *n, rbtree_link *parent, int left) {
+  n->parent = parent;
+  n->left = n->right = t->nil;
+  n->color = RBTREE_GEN_RED;
+  if (parent == t->nil) t->root = n;
+  else if (left) parent->left = n;
+  else parent->right = n;
+  t->size++;
+  rbtree_link *cur = n;
+  while (cur->parent->color == RBTREE_GEN_RED) {
+    rbtree_link *gp = cur->parent->parent;
+    if (cur->parent == gp->left) {
+      rbtree_link *uncle = gp->right;
+      if (uncle->color == RBTREE_GEN_RED) {
+        cur->parent->color = RBTREE_GEN_BLACK;
+        uncle->color = RBTREE_GEN_BLACK;
+        gp->color = RBTREE_GEN_RED;
+        cur = gp;
+      } else {
+        if (cur == cur->parent->right) {
+          cur = cur->parent;
+          rbtree_intrusive_rotate_left(t, cur);
+        }
+        cur->parent->color = RBTREE_GEN_BLACK;
+        cur->parent->parent->color = RBTREE_GEN_RED;
+        rbtree_intrusive_rotate_right(t, cur->parent->parent);
+      }
+    } else {
+      rbtree_link *uncle = gp->left;
+      if (uncle->color == RBTREE_GEN_RED) {
+        cur->parent->color = RBTREE_GEN_BLACK;
+        uncle->color = RBTREE_GEN_BLACK;
+        gp->color = RBTREE_GEN_RED;
+        cur = gp;
+      } else {
+        if (cur == cur->parent->left) {
+          cur = cur->parent;
+          rbtree_intrusive_rotate_right(t, cur);
+        }
+        cur->parent->color = RBTREE_GEN_BLACK;
+        cur->parent->parent->color = RBTREE_GEN_RED;
+        rbtree_intrusive_rotate_left(t, cur->parent->parent);
+      }
+    }
+  }
+  t->root->color = RBTREE_GEN_BLACK;
+}
+
+static inline void rbtree_intrusive_transplant(rbtree_intrusive *t, rbtree_link *u, rbtree_link *v) {
+  if (u->parent == t->nil) t->root = v;
+  else if (u == u->parent->left) u->parent->left = v;
+  else u->parent->right = v;
+  v->parent = u->parent;
+}
+
+static inline void rbtree_intrusive_erase_fixup(rbtree_intrusive *t, rbtree_link *cur) {
+  while (cur != t->root && cur->color == RBTREE_GEN_BLACK) {
+    if (cur == cur->parent->left) {
+      rbtree_link *sibling = cur->parent->right;
+      if (sibling->color == RBTREE_GEN_RED) {
+        sibling->color = RBTREE_GEN_BLACK;
+        cur->parent->color = RBTREE_GEN_RED;
+        rbtree_intrusive_rotate_left(t, cur->parent);
+        sibling = cur->parent->right;
+      }
+      if (sibling->left->color == RBTREE_GEN_BLACK && sibling->right->color == RBTREE_GEN_BLACK) {
+        sibling->color = RBTREE_GEN_RED;
+        cur = cur->parent;
+      } else {
+        if (sibling->right->color == RBTREE_GEN_BLACK) {
+          sibling->left->color = RBTREE_GEN_BLACK;
+          sibling->color = RBTREE_GEN_RED;
+          rbtree_intrusive_rotate_right(t, sibling);
+          sibling = cur->parent->right;
+        }
+        sibling->color = cur->parent->color;
+        cur->parent->color = RBTREE_GEN_BLACK;
+        sibling->right->color = RBTREE_GEN_BLACK;
+        rbtree_intrusive_rotate_left(t, cur->parent);
+        cur = t->root;
+      }
+    } else {
+      rbtree_link *sibling = cur->parent->left;
+      if (sibling->color == RBTREE_GEN_RED) {
+        sibling->color = RBTREE_GEN_BLACK;
+        cur->parent->color = RBTREE_GEN_RED;
+        rbtree_intrusive_rotate_right(t, cur->parent);
+        sibling = cur->parent->left;
+      }
+      if (sibling->right->color == RBTREE_GEN_BLACK && sibling->left->color == RBTREE_GEN_BLACK) {
+        sibling->color = RBTREE_GEN_RED;
+        cur = cur->parent;
+      } else {
+        if (sibling->left->color == RBTREE_GEN_BLACK) {
+          sibling->right->color = RBTREE_GEN_BLACK;
+          sibling->color = RBTREE_GEN_RED;
+          rbtree_intrusive_rotate_left(t, sibling);
+          sibling = cur->parent->left;
+        }
+        sibling->color = cur->parent->color;
+        cur->parent->color = RBTREE_GEN_BLACK;
+        sibling->left->color = RBTREE_GEN_BLACK;
+        rbtree_intrusive_rotate_right(t, cur->parent);
+        cur = t->root;
+      }
+    }
+  }
+  cur->color = RBTREE_GEN_BLACK;
+}
+
+// n을 트리에서 떼어내는 함수 (객체는 caller가 소유하므로 반환하지 않고, 떼어낸 link는 NULL로 비움)
+static inline int rbtree_intrusive_erase(rbtree_intrusive *t, rbtree_link *p) {
+  if (t == NULL || p == NULL || t->root == t->nil) return 0;
+  rbtree_link *x;
+  rbtree_link *y = p;
+  unsigned char y_original_color = y->color;
+  if (p->left == t->nil) {
+    x = p->right;
+    rbtree_intrusive_transplant(t, p, p->right);
+  } else if (p->right == t->nil) {
+    x = p->left;
+    rbtree_intrusive_transplant(t, p, p->left);
+  } else {
+    y = p->right;
+    while (y->left != t->nil) y = y->left;
+    y_original_color = y->color;
+    x = y->right;
+    if (y != p->right) {
+      rbtree_intrusive_transplant(t, y, y->right);
+      y->right = p->right;
+      y->right->parent = y;
+    } else x->parent = y;
+    rbtree_intrusive_transplant(t, p, y);
+    y->left = p->left;
+    y->left->parent = y;
+    y->color = p->color;
+  }
+  if (y_original_color == RBTREE_GEN_BLACK) rbtree_intrusive_erase_fixup(t, x);
+  p->parent = p->left = p->right = NULL;
+  t->size--;
+  return 1;
+}
+
+static inline rbtree_link *rbtree_intrusive_min(const rbtree_intrusive *t) {
+  if (t == NULL || t->root == t->nil) return NULL;
+  rbtree_link *cur = t->root;
+  while (cur->left != t->nil) cur = cur->left;
+  return cur;
+}
+
+static inline rbtree_link *rbtree_intrusive_max(const rbtree_intrusive *t) {
+  if (t == NULL || t->root == t->nil) return NULL;
+  rbtree_link *cur = t->root;
+  while (cur->right != t->nil) cur = cur->right;
+  return cur;
+}
+
+static inline rbtree_link *rbtree_intrusive_next(const rbtree_intrusive *t, const rbtree_link *p) {
+  if (t == NULL || p == NULL) return NULL;
+  rbtree_link *cur;
+  if (p->right != t->nil) {
+    cur = p->right;
+    while (cur->left != t->nil) cur = cur->left;
+    return cur;
+  }
+  cur = p->parent;
+  while (cur != t->nil && p == cur->right) {
+    p = cur;
+    cur = cur->parent;
+  }
+  return cur == t->nil ? NULL : cur;
+}
+
+static inline rbtree_link *rbtree_intrusive_prev(const rbtree_intrusive *t, const rbtree_link *p) {
+  if (t == NULL || p == NULL) return NULL;
+  rbtree_link *cur;
+  if (p->left != t->nil) {
+    cur = p->left;
+    while (cur->right != t->nil) cur = cur->right;
+    return cur;
+  }
+  cur = p->parent;
+  while (cur != t->nil && p == cur->left) {
+    p = cur;
+    cur = cur->parent;
+  }
+  return cur == t->nil ? NULL : cur;
+}
+
+static inline size_t rbtree_intrusive_size(const rbtree_intrusive *t) { return t == NULL ? 0 : t->size; }
+
+#define RBTREE_GENERATE(name, K, V, less)                                                      \
+  typedef struct name##_node {                                                                 \
+    rbtree_link link;  /* 회전과 재조정은 rbtree_intrusive_*가 이 link로 수행 */                           \
+    K key;                                                                                     \
+    V value;                                                                                   \
+  } name##_node;                                                                               \
+                                                                                               \
+  typedef struct name##_chunk {                                                                \
+    struct name##_chunk *next;                                                                 \
+    size_t cap;                                                                                \
+    name##_node nodes[];                                                                       \
+  } name##_chunk;                                                                              \
+                                                                                               \
+  typedef struct {                                                                             \
+    rbtree_intrusive tree;                                                                     \
+    name##_chunk *chunks;                                                                      \
+    name##_node *free_list; /* link.right로 연결 */                                               \
+  } name;                                                                                      \
+                                                                                               \
+  static inline name##_node *name##_of(const rbtree_link *link) {                              \
+    return RBTREE_ENTRY(link, name##_node, link);                                              \
+  }                                                                                            \
+                                                                                               \
+  static inline name *name##_new(void) {                                                       \
+    name *t = (name *)calloc(1, sizeof(name));                                                 \
+    if (t == NULL) return NULL;                                                                \
+    rbtree_intrusive_init(&t->tree);                                                           \
+    return t;                                                                                  \
+  }                                                                                            \
+                                                                                               \
+  static inline void name##_delete(name *t) {                                                  \
+    if (t == NULL) return;                                                                     \
+    name##_chunk *c = t->chunks;                                                               \
+    while (c != NULL) {                                                                        \
+      name##_chunk *next = c->next;                                                            \
+      free(c);                                                                                 \
+      c = next;                                                                                \
+    }                                                                                          \
+    free(t);                                                                                   \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_node_alloc(name *t) {                                      \
+    if (t->free_list == NULL) {                                                                \
+      size_t cap = t->chunks == NULL ? RBTREE_GEN_CHUNK_MIN : t->chunks->cap * 2;              \
+      if (cap > RBTREE_GEN_CHUNK_MAX) cap = RBTREE_GEN_CHUNK_MAX;                              \
+      name##_chunk *c = (name##_chunk *)malloc(sizeof(name##_chunk) + cap * sizeof(name##_node));\
+      if (c == NULL) return NULL;                                                              \
+      c->cap = cap;                                                                            \
+      c->next = t->chunks;                                                                     \
+      t->chunks = c;                                                                           \
+      for (size_t i = cap; i > 0; i--) {                                                       \
+        c->nodes[i - 1].link.right = t->free_list == NULL ? NULL : &t->free_list->link;         \
+        t->free_list = &c->nodes[i - 1];                                                       \
+      }                                                                                        \
+    }                                                                                          \
+    name##_node *p = t->free_list;                                                             \
+    t->free_list = name##_of(p->link.right);                                                   \
+    return p;                                                                                  \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_insert(name *t, const K key, const V value) {              \
+    if (t == NULL) return NULL;                                                                \
+    name##_node *n = name##_node_alloc(t);                                                     \
+    if (n == NULL) return NULL;                                                                \
+    n->key = key;                                                                              \
+    n->value = value;                                                                          \
+    rbtree_link *prev = t->tree.nil;                                                           \
+    rbtree_link *cur = t->tree.root;                                                           \
+    int left = 0;                                                                              \
+    while (cur != t->tree.nil) {                                                               \
+      prev = cur;                                                                              \
+      left = less(key, name##_of(cur)->key);                                                   \
+      cur = left ? cur->left : cur->right;                                                     \
+    }                                                                                          \
+    rbtree_intrusive_link(&t->tree, &n->link, prev, left);                                     \
+    return n;                                                                                  \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_find(const name *t, const K key) {                         \
+    if (t == NULL) return NULL;                                                                \
+    rbtree_link *cur = t->tree.root;                                                           \
+    while (cur != t->tree.nil) {                                                               \
+      name##_node *p = name##_of(cur);                                                         \
+      if (less(key, p->key)) cur = cur->left;                                                  \
+      else if (less(p->key, key)) cur = cur->right;                                            \
+      else return p;                                                                           \
+    }                                                                                          \
+    return NULL;                                                                               \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_lower_bound(const name *t, const K key) {                  \
+    if (t == NULL) return NULL;                                                                \
+    rbtree_link *cur = t->tree.root;                                                           \
+    rbtree_link *res = NULL;                                                                   \
+    while (cur != t->tree.nil) {                                                               \
+      if (less(name##_of(cur)->key, key)) cur = cur->right;                                    \
+      else {                                                                                   \
+        res = cur;                                                                             \
+        cur = cur->left;                                                                       \
+      }                                                                                        \
+    }                                                                                          \
+    return name##_of(res);                                                                     \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_min(const name *t) {                                       \
+    return t == NULL ? NULL : name##_of(rbtree_intrusive_min(&t->tree));                       \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_max(const name *t) {                                       \
+    return t == NULL ? NULL : name##_of(rbtree_intrusive_max(&t->tree));                       \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_next(const name *t, const name##_node *p) {                \
+    if (t == NULL || p == NULL) return NULL;                                                   \
+    return name##_of(rbtree_intrusive_next(&t->tree, &p->link));                               \
+  }                                                                                            \
+                                                                                               \
+  static inline name##_node *name##_prev(const name *t, const name##_node *p) {                \
+    if (t == NULL || p == NULL) return NULL;                                                   \
+    return name##_of(rbtree_intrusive_prev(&t->tree, &p->link));                               \
+  }                                                                                            \
+                                                                                               \
+  static inline int name##_erase(name *t, name##_node *p) {                                    \
+    if (t == NULL || p == NULL || !rbtree_intrusive_erase(&t->tree, &p->link)) return 0;       \
+    p->link.right = t->free_list == NULL ? NULL : &t->free_list->link;                         \
+    t->free_list = p;                                                                          \
+    return 1;                                                                                  \
+  }                                                                                            \
+                                                                                               \
+  static inline size_t name##_size(const name *t) { return t == NULL ? 0 : rbtree_intrusive_size(&t->tree); }
+
+#define RBTREE_GENERATE_INTRUSIVE(name, T, field, K, key_of, less)                             \
+  static inline T *name##_entry(const rbtree_link *link) { return RBTREE_ENTRY(link, T, field); } \
+                                                                                               \
+  static inline T *name##_insert(rbtree_intrusive *t, T *elem) {                               \
+    if (t == NULL || elem == NULL) return NULL;                                                \
+    const K key = key_of((const T *)elem);                                                     \
+    rbtree_link *prev = t->nil;                                                                \
+    rbtree_link *cur = t->root;                                                                \
+    int left = 0;                                                                              \
+    while (cur != t->nil) {                                                                    \
+      prev = cur;                                                                              \
+      left = less(key, key_of((const T *)name##_entry(cur)));                                  \
+      cur = left ? cur->left : cur->right;                                                     \
+    }                                                                                          \
+    rbtree_intrusive_link(t, &elem->field, prev, left);                                        \
+    return elem;                                                                               \
+  }                                                                                            \
+                                                                                               \
+  static inline T *name##_find(const rbtree_intrusive *t, const K key) {                       \
+    if (t == NULL) return NULL;                                                                \
+    rbtree_link *cur = t->root;                                                                \
+    while (cur != t->nil) {                                                                    \
+      const T *elem = name##_entry(cur);                                                       \
+      if (less(key, key_of(elem))) cur = cur->left;                                            \
+      else if (less(key_of(elem), key)) cur = cur->right;                                      \
+      else return (T *)elem;                                                                   \
+    }                                                                                          \
+    return NULL;                                                                               \
+  }                                                                                            \
+                                                                                               \
+  static inline T *name##_lower_bound(const rbtree_intrusive *t, const K key) {                \
+    if (t == NULL) return NULL;                                                                \
+    rbtree_link *cur = t->root;                                                                \
+    rbtree_link *res = NULL;                                                                   \
+    while (cur != t->nil) {                                                                    \
+      if (less(key_of((const T *)name##_entry(cur)), key)) cur = cur->right;                   \
+      else {                                                                                   \
+        res = cur;                                                                             \
+        cur = cur->left;                                                                       \
+      }                                                                                        \
+    }                                                                                          \
+    return name##_entry(res);                                                                  \
+  }                                                                                            \
+                                                                                               \
+  static inline int name##_erase(rbtree_intrusive *t, T *elem) {                               \
+    return elem == NULL ? 0 : rbtree_intrusive_erase(t, &elem->field);                         \
+  }                                                                                            \
+                                                                                               \
+  static inline T *name##_min(const rbtree_intrusive *t) { return name##_entry(rbtree_intrusive_min(t)); } \
+  static inline T *name##_max(const rbtree_intrusive *t) { return name##_entry(rbtree_intrusive_max(t)); } \
+                                                                                               \
+  static inline T *name##_next(const rbtree_intrusive *t, const T *elem) {                     \
+    return elem == NULL ? NULL : name##_entry(rbtree_intrusive_next(t, &elem->field));         \
+  }                                                                                            \
+                                                                                               \
+  static inline T *name##_prev(const rbtree_intrusive *t, const T *elem) {                     \
+    return elem == NULL ? NULL : name##_entry(rbtree_intrusive_prev(t, &elem->field));         \
+  }
+
+#endif  // _RBTREE_GEN_H_
@@ -0,0 +1,453 @@
+#include "rbtree.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// 저장할 때 한 번의 write로 내보내는 key 수
+#define RBTREE_IO_BLOCK 65536
+
+#define RBTREE_FILE_MAGIC 0x45455254u  // "TREE" (little endian), 읽을 때 byte order가 다르면 거부
+#define RBTREE_FNV_OFFSET 0xcbf29ce484222325ull
+#define RBTREE_FNV_PRIME 0x100000001b3ull
+
+uint64_t rbtree_checksum(uint64_t h, const key_t *keys, const size_t n);
+int rbtree_write_all(int fd, const void *buf, size_t len);
+int rbtree_fsync_dir(const char *path);
+int rbtree_save_file(const rbtree *t, const char *path, rbtree_file_header_t *out);
+rbtree *rbtree_load_file(const char *path, rbtree_file_header_t *out);
+
+// key 단위 FNV-1a (key 값 기준이므로 저장과 불러오기에서 같은 값이 나옴)
+uint64_t rbtree_checksum(uint64_t h, const key_t *keys, const size_t n) {
+  for (size_t i = 0; i < n; i++) h = (h ^ (uint32_t)keys[i]) * RBTREE_FNV_PRIME;
+  return h;
+}
+
+// 중간에 끊긴 write를 이어서 len byte를 모두 쓰는 메서드 (실패하면 1)
+int rbtree_write_all(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t w = write(fd, p, len);
+    if (w < 0) return 1;
+    p += w;
+    len -= (size_t)w;
+  }
+  return 0;
+}
+
+// path가 들어 있는 디렉터리를 fsync하는 메서드 (rename이나 새 파일의 이름이 멈춘 뒤에도 남도록)
+int rbtree_fsync_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  size_t len = slash == NULL ? 1 : slash == path ? 1 : (size_t)(slash - path);
+  char *dir = (char *)malloc(len + 1);
+  if (dir == NULL) return 1;
+  if (slash == NULL) dir[0] = '.';
+  else memcpy(dir, path, len);                      // "/file"이면 "/"
+  dir[len] = '\0';
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  free(dir);
+  if (fd < 0) return 1;
+  int err = fsync(fd) != 0;
+  if (close(fd) != 0) err = 1;
+  return err;
+}
+
+// 중위 순회로 key를 block 단위로 모아 "path.tmp"에 쓴 뒤 fsync하고 path로 rename하는 메서드
+// rename 뒤 디렉터리도 fsync하므로 성공하면 멈춰도 새 파일이 남고, 중간에 실패하면 기존 path 파일은 그대로 남음
+int rbtree_save(const rbtree *t, const char *path) {
+  return rbtree_save_file(t, path, NULL);
+}
+
+// rbtree_save와 같고, 성공하면 쓴 header를 out에 복사하는 메서드
+int rbtree_save_file(const rbtree *t, const char *path, rbtree_file_header_t *out) {
+  if (t == NULL || path == NULL) return 1;
+  size_t len = strlen(path);
+  char *tmp = (char *)malloc(len + 5);
+  key_t *buf = (key_t *)malloc(RBTREE_IO_BLOCK * sizeof(key_t));
+  if (tmp == NULL || buf == NULL) {
+    free(tmp);
+    free(buf);
+    return 1;
+  }
+  memcpy(tmp, path, len);
+  memcpy(tmp + len, ".tmp", 5);
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int err = fd < 0;
+  rbtree_file_header_t h;
+  memset(&h, 0, sizeof(h));
+  h.magic = RBTREE_FILE_MAGIC;
+  h.version = RBTREE_FILE_VERSION;
+  h.key_size = sizeof(key_t);
+  h.count = rbtree_size(t);
+  h.checksum = RBTREE_FNV_OFFSET;
+  if (!err) err = lseek(fd, sizeof(h), SEEK_SET) < 0;  // header는 checksum을 다 센 뒤에 씀
+
+  size_t m = 0, written = 0;
+  node_t *first = t->root == t->nil ? NULL : rbtree_min(t);  // 빈 tree의 min은 nil
+  for (node_t *p = first; p != NULL && !err; p = rbtree_next(t, p)) {
+    if (rb_end(p) != p->key) err = 1;               // 파일 형식에 end를 둘 자리가 없으므로 점 구간이 아니면 저장하지 않음
+    for (size_t c = rb_count(p); c > 0 && !err; c--) {  // RBTREE_COUNTED면 개수만큼 펼쳐서 씀
+      buf[m++] = p->key;
+      if (m == RBTREE_IO_BLOCK) {
+        h.checksum = rbtree_checksum(h.checksum, buf, m);
+        err = rbtree_write_all(fd, buf, m * sizeof(key_t));
+        written += m;
+        m = 0;
+      }
+    }
+  }
+  if (!err && m > 0) {
+    h.checksum = rbtree_checksum(h.checksum, buf, m);
+    err = rbtree_write_all(fd, buf, m * sizeof(key_t));
+    written += m;
+  }
+  if (!err) err = written != h.count;
+  if (!err) err = pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h);
+  if (!err) err = fsync(fd) != 0;
+  if (fd >= 0 && close(fd) != 0) err = 1;
+  if (!err) err = rename(tmp, path) != 0;
+  if (err && fd >= 0) unlink(tmp);
+  if (!err) err = rbtree_fsync_dir(path);
+  if (!err && out != NULL) *out = h;
+  free(buf);
+  free(tmp);
+  return err;
+}
+
+// 파일을 mmap해 header와 checksum, 정렬 여부를 확인하고 key 배열로 O(n)에 tree를 만드는 메서드
+// 형식이 맞지 않거나 손상된 파일이면 NULL을 반환
+rbtree *rbtree_load(const char *path) {
+  return rbtree_load_file(path, NULL);
+}
+
+// rbtree_load와 같고, 성공하면 읽은 header를 out에 복사하는 메서드
+rbtree *rbtree_load_file(const char *path, rbtree_file_header_t *out) {
+  if (path == NULL) return NULL;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(rbtree_file_header_t)) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = (size_t)sb.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);                                        // mapping은 fd를 닫아도 유지됨
+  if (map == MAP_FAILED) return NULL;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  rbtree *t = NULL;
+  const rbtree_file_header_t *h = (const rbtree_file_header_t *)map;
+  const key_t *keys = (const key_t *)((const char *)map + sizeof(*h));
+  if (h->magic == RBTREE_FILE_MAGIC && h->version == RBTREE_FILE_VERSION && h->key_size == sizeof(key_t) &&
+      h->count == (size - sizeof(*h)) / sizeof(key_t) && (size - sizeof(*h)) % sizeof(key_t) == 0) {
+    size_t n = (size_t)h->count;
+    int sorted = 1;
+    for (size_t i = 1; i < n && sorted; i++) sorted = keys[i - 1] <= keys[i];
+    if (sorted && rbtree_checksum(RBTREE_FNV_OFFSET, keys, n) == h->checksum) t = rbtree_from_sorted(keys, n);
+    if (t != NULL && out != NULL) *out = *h;
+  }
+  munmap(map, size);
+  return t;
+}
+
+// 변경 log: header 뒤에 삽입/삭제 record를 순서대로 덧붙임
+// header에 log가 이어지는 snapshot의 key 수와 checksum을 적어 두어,
+// checkpoint 도중 snapshot만 바뀐 채 멈췄다면 이미 반영된 log를 다시 적용하지 않음
+#define RBTREE_WAL_MAGIC 0x474f4c57u  // "WLOG"
+#define RBTREE_WAL_VERSION 1
+#define RBTREE_WAL_INSERT 1
+#define RBTREE_WAL_ERASE 2
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t key_size;
+  uint32_t reserved;
+  uint64_t base_count;     // 이 log가 이어지는 snapshot의 key 수 (snapshot이 없으면 0)
+  uint64_t base_checksum;  // 그 snapshot의 checksum (snapshot이 없으면 0)
+} rbtree_wal_header_t;
+
+typedef struct {
+  uint32_t op;
+  key_t key;
+  uint32_t check;  // op와 key의 hash, 끝이 잘린 record를 가려냄
+} rbtree_wal_record_t;
+
+struct rbtree_wal {
+  rbtree *tree;
+  char *snapshot_path;
+  int fd;
+  size_t sync_bytes;
+  unsigned int sync_ms;
+  pthread_mutex_t lock;  // 아래 buffer와 상태를 보호
+  pthread_cond_t cond;
+  char *buf, *spare;     // record를 모으는 buffer와 flush 중인 buffer
+  size_t len, cap;
+  int flushing, stop, failed;  // failed: write/fsync가 한 번 실패하면 이후 변경을 거부
+  pthread_t flusher;
+  int has_flusher;
+  rbtree_wal_stats_t stats;
+};
+
+uint32_t rbtree_wal_check(const uint32_t op, const key_t key);
+int rbtree_wal_reset_log(rbtree_wal *w, const rbtree_file_header_t *base);
+int rbtree_wal_replay(rbtree_wal *w, const rbtree_file_header_t *base);
+int rbtree_wal_append(rbtree_wal *w, const uint32_t op, const key_t key);
+int rbtree_wal_flush(rbtree_wal *w);
+void *rbtree_wal_flusher(void *arg);
+
+uint32_t rbtree_wal_check(const uint32_t op, const key_t key) {
+  uint64_t h = (RBTREE_FNV_OFFSET ^ op) * RBTREE_FNV_PRIME;
+  h = (h ^ (uint32_t)key) * RBTREE_FNV_PRIME;
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+// log를 비우고 base snapshot을 가리키는 header만 남기는 메서드
+int rbtree_wal_reset_log(rbtree_wal *w, const rbtree_file_header_t *base) {
+  rbtree_wal_header_t h;
+  memset(&h, 0, sizeof(h));
+  h.magic = RBTREE_WAL_MAGIC;
+  h.version = RBTREE_WAL_VERSION;
+  h.key_size = sizeof(key_t);
+  if (base != NULL) {
+    h.base_count = base->count;
+    h.base_checksum = base->checksum;
+  }
+  if (ftruncate(w->fd, 0) != 0 || lseek(w->fd, 0, SEEK_SET) < 0) return 1;
+  if (rbtree_write_all(w->fd, &h, sizeof(h)) || fsync(w->fd) != 0) return 1;
+  return 0;
+}
+
+// log의 record를 tree에 다시 적용하는 메서드
+// log가 다른 snapshot에 이어지거나 비어 있으면 새로 시작하고, 끝이 잘린 record는 잘라냄
+// 노드를 할당하지 못하면 log를 그대로 두고 실패 (기록된 변경은 잘린 record가 아니므로 지우지 않음)
+int rbtree_wal_replay(rbtree_wal *w, const rbtree_file_header_t *base) {
+  struct stat sb;
+  if (fstat(w->fd, &sb) != 0) return 1;
+  size_t size = (size_t)sb.st_size;
+  if (size < sizeof(rbtree_wal_header_t)) return rbtree_wal_reset_log(w, base);
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, w->fd, 0);
+  if (map == MAP_FAILED) return 1;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  const rbtree_wal_header_t *h = (const rbtree_wal_header_t *)map;
+  if (h->magic != RBTREE_WAL_MAGIC || h->version != RBTREE_WAL_VERSION || h->key_size != sizeof(key_t)) {
+    munmap(map, size);                              // 다른 형식의 파일은 덮어쓰지 않음
+    return 1;
+  }
+  if (h->base_count != (base != NULL ? base->count : 0) || h->base_checksum != (base != NULL ? base->checksum : 0)) {
+    munmap(map, size);                              // 이미 snapshot에 반영된 log
+    return rbtree_wal_reset_log(w, base);
+  }
+  const rbtree_wal_record_t *r = (const rbtree_wal_record_t *)((const char *)map + sizeof(*h));
+  size_t n = (size - sizeof(*h)) / sizeof(*r), i;
+  for (i = 0; i < n; i++) {
+    if (r[i].check != rbtree_wal_check(r[i].op, r[i].key)) break;
+    if (r[i].op == RBTREE_WAL_INSERT) {
+      if (rbtree_insert(w->tree, r[i].key) == NULL) {
+        munmap(map, size);
+        return 1;
+      }
+    } else if (r[i].op == RBTREE_WAL_ERASE) {
+      node_t *p = rbtree_find(w->tree, r[i].key);
+      if (p != NULL) rbtree_erase(w->tree, p);
+    } else break;
+  }
+  munmap(map, size);
+  w->stats.replayed = i;
+  size_t valid = sizeof(*h) + i * sizeof(*r);
+  if (valid < size && ftruncate(w->fd, valid) != 0) return 1;
+  return lseek(w->fd, 0, SEEK_END) < 0;
+}
+
+// 모인 record를 log에 쓰고 fsync하는 메서드 (lock을 잡은 채 호출)
+// 다른 buffer로 바꾼 뒤 lock을 놓고 쓰므로 fsync 동안에도 record를 계속 모을 수 있음
+int rbtree_wal_flush(rbtree_wal *w) {
+  while (w->flushing) pthread_cond_wait(&w->cond, &w->lock);
+  if (w->len == 0 || w->failed) return w->failed;
+  char *buf = w->buf;
+  size_t len = w->len;
+  w->buf = w->spare;
+  w->spare = buf;
+  w->len = 0;
+  w->flushing = 1;
+  pthread_mutex_unlock(&w->lock);
+  int err = rbtree_write_all(w->fd, buf, len) || fdatasync(w->fd) != 0;
+  pthread_mutex_lock(&w->lock);
+  w->flushing = 0;
+  if (err) w->failed = 1;
+  else {
+    w->stats.syncs++;
+    w->stats.bytes += len;
+  }
+  pthread_cond_broadcast(&w->cond);
+  return w->failed;
+}
+
+// record 하나를 buffer에 넣고 byte 기준을 넘으면 group commit하는 메서드
+int rbtree_wal_append(rbtree_wal *w, const uint32_t op, const key_t key) {
+  rbtree_wal_record_t r = {op, key, rbtree_wal_check(op, key)};
+  pthread_mutex_lock(&w->lock);
+  int err = w->failed;
+  while (!err && w->len + sizeof(r) > w->cap) err = rbtree_wal_flush(w);  // 두 buffer가 모두 차 있으면 기다림
+  if (!err) {
+    memcpy(w->buf + w->len, &r, sizeof(r));
+    w->len += sizeof(r);
+    w->stats.records++;
+    if (w->sync_bytes > 0 && w->len >= w->sync_bytes) err = rbtree_wal_flush(w);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return err;
+}
+
+// sync_ms마다 깨어나 모인 record를 group commit하는 thread
+void *rbtree_wal_flusher(void *arg) {
+  rbtree_wal *w = (rbtree_wal *)arg;
+  pthread_mutex_lock(&w->lock);
+  while (!w->stop) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += w->sync_ms / 1000;
+    ts.tv_nsec += (long)(w->sync_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+    if (!w->stop && w->len > 0) rbtree_wal_flush(w);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+// snapshot을 불러오고 log_path의 log를 다시 적용한 tree를 여는 메서드 (snapshot 파일이 없으면 빈 tree)
+// 변경은 sync_bytes byte가 모이거나 sync_ms ms가 지나면 한 번의 fsync로 기록됨 (0이면 해당 기준을 쓰지 않음)
+rbtree_wal *rbtree_wal_open(const char *snapshot_path, const char *log_path, const size_t sync_bytes, const unsigned int sync_ms) {
+  if (snapshot_path == NULL || log_path == NULL) return NULL;
+  rbtree_wal *w = (rbtree_wal *)calloc(1, sizeof(rbtree_wal));
+  if (w == NULL) return NULL;
+  w->fd = -1;
+  w->sync_bytes = sync_bytes;
+  w->sync_ms = sync_ms;
+  w->cap = sync_bytes > 4096 ? sync_bytes + sizeof(rbtree_wal_record_t) : 4096;
+  w->buf = (char *)malloc(w->cap);
+  w->spare = (char *)malloc(w->cap);
+  w->snapshot_path = strdup(snapshot_path);
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  if (w->buf == NULL || w->spare == NULL || w->snapshot_path == NULL) {
+    delete_rbtree_wal(w);
+    return NULL;
+  }
+
+  rbtree_file_header_t base;
+  struct stat sb;
+  int has_snapshot = stat(snapshot_path, &sb) == 0;
+  w->tree = has_snapshot ? rbtree_load_file(snapshot_path, &base) : new_rbtree();
+  w->fd = open(log_path, O_RDWR | O_CREAT, 0644);
+  if (w->tree == NULL || w->fd < 0 || rbtree_fsync_dir(log_path) || rbtree_wal_replay(w, has_snapshot ? &base : NULL)) {
+    delete_rbtree_wal(w);
+    return NULL;
+  }
+  if (sync_ms > 0) {
+    w->has_flusher = pthread_create(&w->flusher, NULL, rbtree_wal_flusher, w) == 0;
+    if (!w->has_flusher) {
+      delete_rbtree_wal(w);
+      return NULL;
+    }
+  }
+  return w;
+}
+
+// 남은 record를 기록하고 log와 tree를 닫는 메서드
+void delete_rbtree_wal(rbtree_wal *w) {
+  if (w == NULL) return;
+  if (w->has_flusher) {
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->flusher, NULL);
+  }
+  if (w->fd >= 0) {
+    rbtree_wal_sync(w);
+    close(w->fd);
+  }
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+  delete_rbtree(w->tree);
+  free(w->snapshot_path);
+  free(w->spare);
+  free(w->buf);
+  free(w);
+}
+
+// 조회용 tree (변경은 rbtree_wal_insert/rbtree_wal_erase로만)
+rbtree *rbtree_wal_tree(rbtree_wal *w) {
+  return w == NULL ? NULL : w->tree;
+}
+
+// key를 삽입한 뒤 log에 기록하는 메서드 (삽입이나 기록에 실패하면 NULL)
+// 삽입에 실패한 변경은 기록하지 않고, 기록에 실패하면 삽입을 되돌림 (기록은 group commit 전까지 buffer에만 있음)
+node_t *rbtree_wal_insert(rbtree_wal *w, const key_t key) {
+  if (w == NULL) return NULL;
+  node_t *p = rbtree_insert(w->tree, key);
+  if (p != NULL && rbtree_wal_append(w, RBTREE_WAL_INSERT, key)) {
+    rbtree_erase(w->tree, p);                       // RBTREE_COUNTED면 늘린 개수만 줄어듦
+    return NULL;
+  }
+  return p;
+}
+
+// log에 먼저 기록한 뒤 노드를 삭제하는 메서드 (rbtree_erase와 같이 삭제하면 1, 기록에 실패하면 0)
+int rbtree_wal_erase(rbtree_wal *w, node_t *p) {
+  if (w == NULL || p == NULL || rbtree_wal_append(w, RBTREE_WAL_ERASE, p->key)) return 0;
+  return rbtree_erase(w->tree, p);
+}
+
+// 모인 record를 바로 기록하는 메서드 (반환 후에는 그때까지의 변경이 모두 fsync되어 있음)
+int rbtree_wal_sync(rbtree_wal *w) {
+  if (w == NULL) return 1;
+  pthread_mutex_lock(&w->lock);
+  int err = rbtree_wal_flush(w);
+  while (!err && w->flushing) pthread_cond_wait(&w->cond, &w->lock);
+  err = w->failed;
+  pthread_mutex_unlock(&w->lock);
+  return err;
+}
+
+// 현재 tree를 snapshot으로 저장하고 log를 비우는 메서드
+// snapshot이 바뀐 뒤 log를 비우기 전에 멈추면, 다음 open에서 log의 base가 맞지 않아 log를 버림
+int rbtree_wal_checkpoint(rbtree_wal *w) {
+  if (w == NULL) return 1;
+  pthread_mutex_lock(&w->lock);
+  while (w->flushing) pthread_cond_wait(&w->cond, &w->lock);
+  int err = w->failed;
+  rbtree_file_header_t base;
+  if (!err) err = rbtree_save_file(w->tree, w->snapshot_path, &base);
+  if (!err) {
+    w->len = 0;                                     // 모인 record는 이미 snapshot에 반영됨
+    err = rbtree_wal_reset_log(w, &base);
+    if (err) w->failed = 1;
+    else w->stats.checkpoints++;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return err;
+}
+
+void rbtree_wal_stats(rbtree_wal *w, rbtree_wal_stats_t *st) {
+  if (st == NULL) return;
+  memset(st, 0, sizeof(*st));
+  if (w == NULL) return;
+  pthread_mutex_lock(&w->lock);
+  *st = w->stats;
+  pthread_mutex_unlock(&w->lock);
+}
@@ -0,0 +1,436 @@
+#include "rbtree.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+// 낙관적 읽기를 포기하고 read lock을 잡기 전까지 다시 시도하는 횟수
+#define RBTREE_MT_RETRY 8
+// 읽는 도중 회전이 일어나 경로에 cycle이 생겨도 멈추도록 하는 탐색 길이 상한 (높이 <= 2log(n+1))
+#define RBTREE_MT_MAX_STEPS 256
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+// 쓰기는 rwlock으로 직렬화하고, 점 조회는 seqlock으로 lock 없이 읽음
+// reader는 LOAD로, writer(rbtree.c의 삽입/삭제/회전)는 RB_STORE로 연결을 읽고 쓰므로 data race가 없음
+// 노드는 slab chunk에서 재사용될 뿐 tree가 삭제되기 전에는 반환되지 않으므로
+// 읽는 도중 삭제된 노드를 따라가도 잘못된 메모리에 접근하지 않음 (free list의 끝 NULL만 확인)
+// chunk를 반환하는 rbtree_compact는 이 보장을 깨므로 rbtree_mt의 tree에는 쓰지 않음 (tree는 밖에 드러나지 않음)
+struct rbtree_mt {
+  rbtree *tree;
+  pthread_rwlock_t lock;
+  unsigned long seq;  // 쓰기 중에는 홀수
+};
+
+void rbtree_mt_write_begin(rbtree_mt *m);
+void rbtree_mt_write_end(rbtree_mt *m);
+unsigned long rbtree_mt_read_begin(rbtree_mt *m);
+int rbtree_mt_read_retry(rbtree_mt *m, unsigned long seq);
+int rbtree_mt_find_optimistic(const rbtree *t, const key_t key, int *found);
+int rbtree_mt_edge_optimistic(const rbtree *t, const int right, key_t *out, int *found);
+int rbtree_mt_edge(rbtree_mt *m, const int right, key_t *out);
+
+rbtree_mt *new_rbtree_mt(void) {
+  rbtree_mt *m = (rbtree_mt *)calloc(1, sizeof(rbtree_mt));
+  if (m == NULL) return NULL;
+  m->tree = new_rbtree();
+  if (m->tree == NULL || pthread_rwlock_init(&m->lock, NULL) != 0) {
+    delete_rbtree(m->tree);
+    free(m);
+    return NULL;
+  }
+  return m;
+}
+
+void delete_rbtree_mt(rbtree_mt *m) {
+  if (m != NULL) {
+    pthread_rwlock_destroy(&m->lock);
+    delete_rbtree(m->tree);
+    free(m);
+  }
+}
+
+// 쓰기 구간 시작: lock을 잡고 seq를 홀수로 만드는 메서드
+void rbtree_mt_write_begin(rbtree_mt *m) {
+  pthread_rwlock_wrlock(&m->lock);
+  __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// 쓰기 구간 끝: seq를 짝수로 되돌리고 lock을 푸는 메서드
+void rbtree_mt_write_end(rbtree_mt *m) {
+  __atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+  pthread_rwlock_unlock(&m->lock);
+}
+
+// 진행 중인 쓰기가 끝날 때까지 기다린 뒤 seq를 읽는 메서드
+unsigned long rbtree_mt_read_begin(rbtree_mt *m) {
+  unsigned long seq;
+  while ((seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE)) & 1) sched_yield();
+  return seq;
+}
+
+// 읽는 동안 쓰기가 있었는지 확인하는 메서드
+int rbtree_mt_read_retry(rbtree_mt *m, unsigned long seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&m->seq, __ATOMIC_RELAXED) != seq;
+}
+
+int rbtree_mt_insert(rbtree_mt *m, const key_t key) {
+  if (m == NULL) return 1;
+  rbtree_mt_write_begin(m);
+  node_t *p = rbtree_insert(m->tree, key);
+  rbtree_mt_write_end(m);
+  return p == NULL;
+}
+
+// key를 가진 노드 하나를 삭제하고, 삭제했으면 1을 반환
+int rbtree_mt_erase(rbtree_mt *m, const key_t key) {
+  if (m == NULL) return 0;
+  rbtree_mt_write_begin(m);
+  node_t *p = rbtree_find(m->tree, key);
+  int erased = p != NULL && rbtree_erase(m->tree, p);
+  rbtree_mt_write_end(m);
+  return erased;
+}
+
+// lock 없이 key를 찾아 결과를 found에 기록하고, 읽는 도중 구조가 깨져 보이면 0을 반환
+int rbtree_mt_find_optimistic(const rbtree *t, const key_t key, int *found) {
+  node_t *nil = t->nil;
+  node_t *cur = LOAD(t->root);
+  for (int steps = 0; cur != nil; steps++) {
+    if (cur == NULL || steps == RBTREE_MT_MAX_STEPS) return 0;
+    key_t k = LOAD(cur->key);
+    if (k > key) cur = LOAD(cur->left);
+    else if (k < key) cur = LOAD(cur->right);
+    else {
+      *found = 1;
+      return 1;
+    }
+  }
+  *found = 0;
+  return 1;
+}
+
+// lock 없이 tree에 기록된 최솟값(최댓값) 노드의 key를 읽고, 읽는 도중 구조가 깨져 보이면 0을 반환
+int rbtree_mt_edge_optimistic(const rbtree *t, const int right, key_t *out, int *found) {
+  node_t *cur = right ? LOAD(t->rightmost) : LOAD(t->leftmost);
+  if (cur == NULL) return 0;
+  *found = cur != t->nil;
+  if (*found) *out = LOAD(cur->key);
+  return 1;
+}
+
+int rbtree_mt_find(rbtree_mt *m, const key_t key) {
+  if (m == NULL) return 0;
+  int found = 0;
+  for (int i = 0; i < RBTREE_MT_RETRY; i++) {
+    unsigned long seq = rbtree_mt_read_begin(m);
+    if (rbtree_mt_find_optimistic(m->tree, key, &found) && !rbtree_mt_read_retry(m, seq)) return found;
+  }
+  pthread_rwlock_rdlock(&m->lock);  // 쓰기가 잦으면 read lock으로 전환
+  found = rbtree_find(m->tree, key) != NULL;
+  pthread_rwlock_unlock(&m->lock);
+  return found;
+}
+
+// 최솟값(right면 최댓값)을 out에 복사하고, tree가 비어 있으면 0을 반환
+int rbtree_mt_edge(rbtree_mt *m, const int right, key_t *out) {
+  if (m == NULL) return 0;
+  int found = 0;
+  key_t key;
+  for (int i = 0; i < RBTREE_MT_RETRY; i++) {
+    unsigned long seq = rbtree_mt_read_begin(m);
+    if (rbtree_mt_edge_optimistic(m->tree, right, &key, &found) && !rbtree_mt_read_retry(m, seq)) {
+      if (found && out != NULL) *out = key;
+      return found;
+    }
+  }
+  pthread_rwlock_rdlock(&m->lock);
+  found = m->tree->root != m->tree->nil;
+  if (found && out != NULL) *out = (right ? rbtree_max(m->tree) : rbtree_min(m->tree))->key;
+  pthread_rwlock_unlock(&m->lock);
+  return found;
+}
+
+int rbtree_mt_min(rbtree_mt *m, key_t *out) {
+  return rbtree_mt_edge(m, 0, out);
+}
+
+int rbtree_mt_max(rbtree_mt *m, key_t *out) {
+  return rbtree_mt_edge(m, 1, out);
+}
+
+// range scan은 콜백이 일관된 tree를 보도록 read lock 아래에서 수행 (reader끼리는 막지 않음)
+size_t rbtree_mt_range_scan(rbtree_mt *m, const key_t lo, const key_t hi, rbtree_visit_t visit, void *arg) {
+  if (m == NULL) return 0;
+  pthread_rwlock_rdlock(&m->lock);
+  size_t cnt = rbtree_range_scan(m->tree, lo, hi, visit, arg);
+  pthread_rwlock_unlock(&m->lock);
+  return cnt;
+}
+
+int rbtree_mt_to_array(rbtree_mt *m, key_t *arr, const size_t n) {
+  if (m == NULL) return 1;
+  pthread_rwlock_rdlock(&m->lock);
+  int res = rbtree_to_array(m->tree, arr, n);
+  pthread_rwlock_unlock(&m->lock);
+  return res;
+}
+
+size_t rbtree_mt_size(rbtree_mt *m) {
+  if (m == NULL) return 0;
+  pthread_rwlock_rdlock(&m->lock);
+  size_t n = rbtree_size(m->tree);
+  pthread_rwlock_unlock(&m->lock);
+  return n;
+}
+
+// key 범위로 나눈 N개의 rbtree_mt (shard마다 lock과 allocator가 따로 있음)
+// shard i는 [bounds[i - 1], bounds[i]) 범위의 key를 가지므로 shard 순서가 곧 key 순서
+struct rbtree_sharded {
+  size_t nshards;
+  rbtree_mt **shards;
+  key_t *bounds;           // nshards - 1개
+  unsigned long seq;       // 경계를 바꾸는 중에는 홀수
+};
+
+size_t rbtree_sharded_index(rbtree_sharded *s, const key_t key);
+unsigned long rbtree_sharded_read_begin(rbtree_sharded *s);
+int rbtree_sharded_read_retry(rbtree_sharded *s, unsigned long seq);
+rbtree_mt *rbtree_sharded_write_begin(rbtree_sharded *s, const key_t key);
+void rbtree_sharded_lock_all(rbtree_sharded *s, const int write);
+void rbtree_sharded_unlock_all(rbtree_sharded *s, const int write);
+int rbtree_sharded_edge(rbtree_sharded *s, const int right, key_t *out);
+int rbtree_sharded_key_cmp(const void *a, const void *b);
+int rbtree_sharded_visit(node_t *p, void *arg);
+
+// bounds가 NULL이면 key 전체 범위를 균등하게 나눔
+rbtree_sharded *new_rbtree_sharded(const size_t nshards, const key_t *bounds) {
+  if (nshards == 0) return NULL;
+  rbtree_sharded *s = (rbtree_sharded *)calloc(1, sizeof(rbtree_sharded));
+  if (s == NULL) return NULL;
+  s->nshards = nshards;
+  s->shards = (rbtree_mt **)calloc(nshards, sizeof(rbtree_mt *));
+  s->bounds = (key_t *)calloc(nshards, sizeof(key_t));
+  if (s->shards == NULL || s->bounds == NULL) {
+    delete_rbtree_sharded(s);
+    return NULL;
+  }
+  for (size_t i = 0; i < nshards; i++) {
+    if ((s->shards[i] = new_rbtree_mt()) == NULL) {
+      delete_rbtree_sharded(s);
+      return NULL;
+    }
+  }
+  for (size_t i = 0; i + 1 < nshards; i++) {
+    if (bounds != NULL) s->bounds[i] = bounds[i];
+    else s->bounds[i] = (key_t)(INT_MIN + (long long)(i + 1) * ((long long)INT_MAX - INT_MIN + 1) / nshards);
+  }
+  return s;
+}
+
+void delete_rbtree_sharded(rbtree_sharded *s) {
+  if (s != NULL) {
+    if (s->shards != NULL)
+      for (size_t i = 0; i < s->nshards; i++) delete_rbtree_mt(s->shards[i]);
+    free(s->shards);
+    free(s->bounds);
+    free(s);
+  }
+}
+
+// key가 들어갈 shard 번호 (key 이하인 경계의 수)를 반환하는 메서드
+size_t rbtree_sharded_index(rbtree_sharded *s, const key_t key) {
+  size_t lo = 0, hi = s->nshards - 1;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (LOAD(s->bounds[mid]) <= key) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+unsigned long rbtree_sharded_read_begin(rbtree_sharded *s) {
+  unsigned long seq;
+  while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1) sched_yield();
+  return seq;
+}
+
+int rbtree_sharded_read_retry(rbtree_sharded *s, unsigned long seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// key가 속한 shard의 쓰기 lock을 잡는 메서드 (lock을 잡는 사이 경계가 바뀌었으면 다시 시도)
+rbtree_mt *rbtree_sharded_write_begin(rbtree_sharded *s, const key_t key) {
+  for (;;) {
+    unsigned long seq = rbtree_sharded_read_begin(s);
+    rbtree_mt *m = s->shards[rbtree_sharded_index(s, key)];
+    rbtree_mt_write_begin(m);
+    if (!rbtree_sharded_read_retry(s, seq)) return m;
+    rbtree_mt_write_end(m);
+  }
+}
+
+// 모든 shard의 lock을 shard 순서대로 잡는 메서드 (순서가 같으므로 교착 상태가 생기지 않음)
+void rbtree_sharded_lock_all(rbtree_sharded *s, const int write) {
+  for (size_t i = 0; i < s->nshards; i++) {
+    if (write) rbtree_mt_write_begin(s->shards[i]);
+    else pthread_rwlock_rdlock(&s->shards[i]->lock);
+  }
+}
+
+void rbtree_sharded_unlock_all(rbtree_sharded *s, const int write) {
+  for (size_t i = s->nshards; i > 0; i--) {
+    if (write) rbtree_mt_write_end(s->shards[i - 1]);
+    else pthread_rwlock_unlock(&s->shards[i - 1]->lock);
+  }
+}
+
+int rbtree_sharded_insert(rbtree_sharded *s, const key_t key) {
+  if (s == NULL) return 1;
+  rbtree_mt *m = rbtree_sharded_write_begin(s, key);
+  node_t *p = rbtree_insert(m->tree, key);
+  rbtree_mt_write_end(m);
+  return p == NULL;
+}
+
+int rbtree_sharded_erase(rbtree_sharded *s, const key_t key) {
+  if (s == NULL) return 0;
+  rbtree_mt *m = rbtree_sharded_write_begin(s, key);
+  node_t *p = rbtree_find(m->tree, key);
+  int erased = p != NULL && rbtree_erase(m->tree, p);
+  rbtree_mt_write_end(m);
+  return erased;
+}
+
+int rbtree_sharded_find(rbtree_sharded *s, const key_t key) {
+  if (s == NULL) return 0;
+  for (;;) {
+    unsigned long seq = rbtree_sharded_read_begin(s);
+    int found = rbtree_mt_find(s->shards[rbtree_sharded_index(s, key)], key);
+    if (!rbtree_sharded_read_retry(s, seq)) return found;
+  }
+}
+
+// 비어 있지 않은 첫(right면 마지막) shard의 최솟값(최댓값)을 찾는 메서드
+int rbtree_sharded_edge(rbtree_sharded *s, const int right, key_t *out) {
+  if (s == NULL) return 0;
+  for (;;) {
+    unsigned long seq = rbtree_sharded_read_begin(s);
+    int found = 0;
+    key_t key;
+    for (size_t i = 0; i < s->nshards && !found; i++)
+      found = rbtree_mt_edge(s->shards[right ? s->nshards - 1 - i : i], right, &key);
+    if (rbtree_sharded_read_retry(s, seq)) continue;
+    if (found && out != NULL) *out = key;
+    return found;
+  }
+}
+
+int rbtree_sharded_min(rbtree_sharded *s, key_t *out) {
+  return rbtree_sharded_edge(s, 0, out);
+}
+
+int rbtree_sharded_max(rbtree_sharded *s, key_t *out) {
+  return rbtree_sharded_edge(s, 1, out);
+}
+
+// range scan 콜백이 멈추라고 했는지 shard를 넘어가며 기억하기 위한 wrapper
+typedef struct {
+  rbtree_visit_t visit;
+  void *arg;
+  int stopped;
+} sharded_visit_t;
+
+int rbtree_sharded_visit(node_t *p, void *arg) {
+  sharded_visit_t *v = (sharded_visit_t *)arg;
+  if (v->visit != NULL && v->visit(p, v->arg)) v->stopped = 1;
+  return v->stopped;
+}
+
+// [lo, hi)와 겹치는 shard를 key 순서대로 scan (모든 shard의 read lock을 잡아 일관된 상태를 봄)
+size_t rbtree_sharded_range_scan(rbtree_sharded *s, const key_t lo, const key_t hi, rbtree_visit_t visit, void *arg) {
+  if (s == NULL || !(lo < hi)) return 0;
+  rbtree_sharded_lock_all(s, 0);
+  sharded_visit_t v = {visit, arg, 0};
+  size_t cnt = 0;
+  for (size_t i = rbtree_sharded_index(s, lo); i < s->nshards && !v.stopped; i++) {
+    if (i > 0 && s->bounds[i - 1] >= hi) break;
+    cnt += rbtree_range_scan(s->shards[i]->tree, lo, hi, rbtree_sharded_visit, &v);
+  }
+  rbtree_sharded_unlock_all(s, 0);
+  return cnt;
+}
+
+// shard는 key 범위 순서대로 나뉘어 있으므로 shard 순서대로 이어 붙이면 정렬된 결과가 됨
+int rbtree_sharded_to_array(rbtree_sharded *s, key_t *arr, const size_t n) {
+  if (s == NULL || arr == NULL || n == 0) return 1;
+  rbtree_sharded_lock_all(s, 0);
+  size_t idx = 0;
+  for (size_t i = 0; i < s->nshards && idx < n; i++) {
+    rbtree *t = s->shards[i]->tree;
+    size_t m = rbtree_size(t);
+    if (m > n - idx) m = n - idx;
+    if (m > 0) rbtree_to_array(t, arr + idx, m);
+    idx += m;
+  }
+  rbtree_sharded_unlock_all(s, 0);
+  return 0;
+}
+
+size_t rbtree_sharded_size(rbtree_sharded *s) {
+  if (s == NULL) return 0;
+  size_t n = 0;
+  for (size_t i = 0; i < s->nshards; i++) n += rbtree_mt_size(s->shards[i]);
+  return n;
+}
+
+int rbtree_sharded_key_cmp(const void *a, const void *b) {
+  const key_t x = *(const key_t *)a, y = *(const key_t *)b;
+  return (x > y) - (x < y);
+}
+
+// 표본 key의 분위수로 경계를 다시 정하고 모든 key를 새 shard로 옮기는 메서드 (O(n))
+// 노드 메모리는 각 shard의 chunk에 남아 재사용되므로 lock 없이 읽던 reader도 안전함
+int rbtree_sharded_rebalance(rbtree_sharded *s, const key_t *sample, const size_t n) {
+  if (s == NULL || sample == NULL || n == 0) return 1;
+  key_t *sorted = (key_t *)malloc(n * sizeof(key_t));
+  if (sorted == NULL) return 1;
+  for (size_t i = 0; i < n; i++) sorted[i] = sample[i];
+  qsort(sorted, n, sizeof(key_t), rbtree_sharded_key_cmp);
+
+  rbtree_sharded_lock_all(s, 1);                    // 모든 shard를 잠그므로 동시에 부른 rebalance도 차례로 수행됨
+  __atomic_fetch_add(&s->seq, 1, __ATOMIC_RELAXED); // 홀수: 경계를 바꾸는 중
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  size_t total = 0;
+  for (size_t i = 0; i < s->nshards; i++) total += rbtree_size(s->shards[i]->tree);
+  key_t *all = (key_t *)malloc((total ? total : 1) * sizeof(key_t));
+  int res = all == NULL;
+  if (!res) {
+    size_t idx = 0;
+    for (size_t i = 0; i < s->nshards; i++) {
+      rbtree *t = s->shards[i]->tree;
+      if (rbtree_size(t) > 0) rbtree_to_array(t, all + idx, rbtree_size(t));
+      idx += rbtree_size(t);
+    }
+    for (size_t i = 0; i + 1 < s->nshards; i++)
+      __atomic_store_n(&s->bounds[i], sorted[(i + 1) * n / s->nshards], __ATOMIC_RELAXED);
+    size_t lo = 0;
+    for (size_t i = 0; i < s->nshards; i++) {
+      size_t hi = lo;
+      while (hi < total && (i + 1 == s->nshards || all[hi] < s->bounds[i])) hi++;
+      res |= rbtree_assign_sorted(s->shards[i]->tree, all + lo, hi - lo);
+      lo = hi;
+    }
+  }
+
+  __atomic_fetch_add(&s->seq, 1, __ATOMIC_RELEASE);  // 짝수: lock을 놓기 전에 끝냄
+  rbtree_sharded_unlock_all(s, 1);
+  free(all);
+  free(sorted);
+  return res;
+}
@@ -0,0 +1,372 @@
+#include "rbtree.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+// 변경할 때 경로의 노드만 복사해 이전 버전을 그대로 남기는 tree
+// 노드는 parent 없이 자식 pointer만 가지므로 여러 버전이 서브트리를 공유할 수 있고,
+// 각 노드의 refs는 그 노드를 가리키는 부모 노드와 root(writer, snapshot)의 수
+// writer는 refs가 1인 노드만 제자리에서 고치므로, snapshot이 없으면 복사 없이 보통의 tree처럼 동작함
+// 균형은 재귀 구현이 간단한 left-leaning RB tree(2-3 tree와 대응)로 맞춤
+#define RBTREE_P_RED 0
+#define RBTREE_P_BLACK 1
+#define RBTREE_P_MAX_HEIGHT 128                     // 높이 <= 2log(n+1)
+
+typedef struct rbtree_pnode {
+  struct rbtree_pnode *left, *right;
+  key_t key;
+  unsigned char color;
+  unsigned int refs;
+  size_t size;  // 서브트리의 key 수
+} rbtree_pnode;
+
+struct rbtree_persistent {
+  rbtree_pnode *root;    // writer가 가진 현재 버전 (root의 refs 하나를 차지)
+  pthread_mutex_t lock;  // writer끼리, 그리고 writer와 rbtree_snapshot을 직렬화
+  rbtree_pnode *reserve; // 변경 하나가 쓸 수 있는 만큼 미리 할당한 노드 (left로 연결)
+  size_t reserved;
+};
+
+struct rbtree_version {
+  rbtree_pnode *root;
+};
+
+rbtree_pnode *rbtree_p_own(rbtree_persistent *t, rbtree_pnode *p);
+void rbtree_p_release(rbtree_pnode *p);
+int rbtree_p_reserve(rbtree_persistent *t);
+rbtree_pnode *rbtree_p_insert(rbtree_persistent *t, rbtree_pnode *h, const key_t key);
+rbtree_pnode *rbtree_p_erase(rbtree_persistent *t, rbtree_pnode *h, size_t r);
+rbtree_pnode *rbtree_p_erase_min(rbtree_persistent *t, rbtree_pnode *h);
+
+static inline int rbtree_p_red(const rbtree_pnode *p) {
+  return p != NULL && p->color == RBTREE_P_RED;
+}
+
+static inline size_t rbtree_p_size(const rbtree_pnode *p) {
+  return p == NULL ? 0 : p->size;
+}
+
+static inline unsigned int rbtree_p_refs(const rbtree_pnode *p) {
+  return __atomic_load_n(&p->refs, __ATOMIC_ACQUIRE);  // reader가 release하기 전에 읽은 것이 먼저 일어남
+}
+
+static inline void rbtree_p_retain(rbtree_pnode *p) {
+  if (p != NULL) __atomic_fetch_add(&p->refs, 1, __ATOMIC_RELAXED);
+}
+
+// 변경 하나가 복사하거나 새로 만들 수 있는 최대 노드 수만큼 reserve를 채우는 메서드
+// 중간에 할당이 실패해 tree가 반쯤 바뀐 채 남는 일이 없도록 변경을 시작하기 전에 확보함
+int rbtree_p_reserve(rbtree_persistent *t) {
+  size_t height = 2;                                // 높이 <= 2log(n + 1)
+  for (size_t n = rbtree_p_size(t->root) + 1; n > 1; n >>= 1) height += 2;
+  size_t need = 6 * height + 8;                     // level마다 경로의 노드와 회전, 색 바꾸기로 고치는 자식/손자
+  while (t->reserved < need) {
+    rbtree_pnode *p = (rbtree_pnode *)malloc(sizeof(rbtree_pnode));
+    if (p == NULL) return 1;
+    p->left = t->reserve;
+    t->reserve = p;
+    t->reserved++;
+  }
+  return 0;
+}
+
+static rbtree_pnode *rbtree_p_alloc(rbtree_persistent *t) {
+  rbtree_pnode *p = t->reserve;
+  t->reserve = p->left;
+  t->reserved--;
+  return p;
+}
+
+// 노드의 참조 하나를 놓고, 마지막 참조였으면 노드를 반환한 뒤 자식의 참조도 놓는 메서드
+void rbtree_p_release(rbtree_pnode *p) {
+  while (p != NULL && __atomic_fetch_sub(&p->refs, 1, __ATOMIC_ACQ_REL) == 1) {
+    rbtree_pnode *right = p->right;
+    rbtree_p_release(p->left);
+    free(p);
+    p = right;
+  }
+}
+
+// writer가 고칠 수 있는 p를 반환하는 메서드 (다른 버전과 공유 중이면 복사본을 반환)
+// 부모는 이미 writer 소유이므로, 반환값을 부모의 자식 자리에 넣으면 p에 대한 참조 하나가 복사본으로 옮겨감
+rbtree_pnode *rbtree_p_own(rbtree_persistent *t, rbtree_pnode *p) {
+  if (p == NULL || rbtree_p_refs(p) == 1) return p;
+  rbtree_pnode *c = rbtree_p_alloc(t);
+  c->left = p->left;
+  c->right = p->right;
+  c->key = p->key;
+  c->color = p->color;
+  c->size = p->size;
+  c->refs = 1;
+  rbtree_p_retain(c->left);
+  rbtree_p_retain(c->right);
+  rbtree_p_release(p);
+  return c;
+}
+
+static inline void rbtree_p_update(rbtree_pnode *h) {
+  h->size = rbtree_p_size(h->left) + rbtree_p_size(h->right) + 1;
+}
+
+// h는 writer 소유, 회전으로 올라오는 자식도 소유한 뒤 고침
+static rbtree_pnode *rbtree_p_rotate_left(rbtree_persistent *t, rbtree_pnode *h) {
+  rbtree_pnode *x = rbtree_p_own(t, h->right);
+  h->right = x->left;
+  x->left = h;
+  x->color = h->color;
+  h->color = RBTREE_P_RED;
+  x->size = h->size;
+  rbtree_p_update(h);
+  return x;
+}
+
+static rbtree_pnode *rbtree_p_rotate_right(rbtree_persistent *t, rbtree_pnode *h) {
+  rbtree_pnode *x = rbtree_p_own(t, h->left);
+  h->left = x->right;
+  x->right = h;
+  x->color = h->color;
+  h->color = RBTREE_P_RED;
+  x->size = h->size;
+  rbtree_p_update(h);
+  return x;
+}
+
+static void rbtree_p_flip(rbtree_persistent *t, rbtree_pnode *h) {
+  h->left = rbtree_p_own(t, h->left);
+  h->right = rbtree_p_own(t, h->right);
+  h->color ^= 1;
+  h->left->color ^= 1;
+  h->right->color ^= 1;
+}
+
+static rbtree_pnode *rbtree_p_balance(rbtree_persistent *t, rbtree_pnode *h) {
+  if (rbtree_p_red(h->right) && !rbtree_p_red(h->left)) h = rbtree_p_rotate_left(t, h);
+  if (rbtree_p_red(h->left) && rbtree_p_red(h->left->left)) h = rbtree_p_rotate_right(t, h);
+  if (rbtree_p_red(h->left) && rbtree_p_red(h->right)) rbtree_p_flip(t, h);
+  rbtree_p_update(h);
+  return h;
+}
+
+static rbtree_pnode *rbtree_p_move_red_left(rbtree_persistent *t, rbtree_pnode *h) {
+  rbtree_p_flip(t, h);
+  if (rbtree_p_red(h->right->left)) {
+    h->right = rbtree_p_rotate_right(t, h->right);
+    h = rbtree_p_rotate_left(t, h);
+    rbtree_p_flip(t, h);
+  }
+  return h;
+}
+
+static rbtree_pnode *rbtree_p_move_red_right(rbtree_persistent *t, rbtree_pnode *h) {
+  rbtree_p_flip(t, h);
+  if (rbtree_p_red(h->left->left)) {
+    h = rbtree_p_rotate_right(t, h);
+    rbtree_p_flip(t, h);
+  }
+  return h;
+}
+
+// 같은 key는 오른쪽으로 보내 rbtree_insert와 같이 중복 저장
+rbtree_pnode *rbtree_p_insert(rbtree_persistent *t, rbtree_pnode *h, const key_t key) {
+  if (h == NULL) {
+    h = rbtree_p_alloc(t);
+    h->left = h->right = NULL;
+    h->key = key;
+    h->color = RBTREE_P_RED;
+    h->refs = 1;
+    h->size = 1;
+    return h;
+  }
+  h = rbtree_p_own(t, h);
+  if (key < h->key) h->left = rbtree_p_insert(t, h->left, key);
+  else h->right = rbtree_p_insert(t, h->right, key);
+  return rbtree_p_balance(t, h);
+}
+
+rbtree_pnode *rbtree_p_erase_min(rbtree_persistent *t, rbtree_pnode *h) {
+  h = rbtree_p_own(t, h);
+  if (h->left == NULL) {                            // LLRB에서 왼쪽이 없으면 오른쪽도 없음
+    rbtree_p_release(h);
+    return NULL;
+  }
+  if (!rbtree_p_red(h->left) && !rbtree_p_red(h->left->left)) h = rbtree_p_move_red_left(t, h);
+  h->left = rbtree_p_erase_min(t, h->left);
+  return rbtree_p_balance(t, h);
+}
+
+// h 서브트리에서 r번째(0부터) key를 삭제하는 메서드 (탐색 경로의 2-노드를 미리 3-노드로 바꾸며 내려감)
+// 같은 key가 회전으로 양쪽 서브트리에 나뉠 수 있어 key 대신 서브트리 크기로 위치를 찾음
+// h에서의 회전은 서브트리의 중위 순서를 바꾸지 않으므로 r은 그대로 두고 왼쪽 크기만 다시 읽음
+rbtree_pnode *rbtree_p_erase(rbtree_persistent *t, rbtree_pnode *h, size_t r) {
+  h = rbtree_p_own(t, h);
+  if (r < rbtree_p_size(h->left)) {
+    if (!rbtree_p_red(h->left) && !rbtree_p_red(h->left->left)) h = rbtree_p_move_red_left(t, h);
+    h->left = rbtree_p_erase(t, h->left, r);
+  } else {
+    if (rbtree_p_red(h->left)) h = rbtree_p_rotate_right(t, h);
+    if (h->right == NULL) {                         // 왼쪽이 red가 아니므로 왼쪽도 없고 r은 h
+      rbtree_p_release(h);
+      return NULL;
+    }
+    if (!rbtree_p_red(h->right) && !rbtree_p_red(h->right->left)) h = rbtree_p_move_red_right(t, h);
+    size_t left = rbtree_p_size(h->left);
+    if (r == left) {                                // 오른쪽 서브트리의 최솟값으로 바꾸고 그 노드를 삭제
+      const rbtree_pnode *m = h->right;
+      while (m->left != NULL) m = m->left;
+      h->key = m->key;
+      h->right = rbtree_p_erase_min(t, h->right);
+    } else h->right = rbtree_p_erase(t, h->right, r - left - 1);
+  }
+  return rbtree_p_balance(t, h);
+}
+
+static const rbtree_pnode *rbtree_p_find(const rbtree_pnode *p, const key_t key) {
+  while (p != NULL && p->key != key) p = key < p->key ? p->left : p->right;
+  return p;
+}
+
+// key보다 작은 key의 수 (같은 key 중 첫 번째의 순위)
+static size_t rbtree_p_rank(const rbtree_pnode *p, const key_t key) {
+  size_t r = 0;
+  while (p != NULL) {
+    if (p->key < key) {
+      r += rbtree_p_size(p->left) + 1;
+      p = p->right;
+    } else p = p->left;
+  }
+  return r;
+}
+
+rbtree_persistent *new_rbtree_persistent(void) {
+  rbtree_persistent *t = (rbtree_persistent *)calloc(1, sizeof(rbtree_persistent));
+  if (t == NULL) return NULL;
+  if (pthread_mutex_init(&t->lock, NULL) != 0) {
+    free(t);
+    return NULL;
+  }
+  return t;
+}
+
+// writer의 버전을 놓는 메서드 (아직 release하지 않은 snapshot은 계속 읽을 수 있음)
+void delete_rbtree_persistent(rbtree_persistent *t) {
+  if (t == NULL) return;
+  rbtree_p_release(t->root);
+  while (t->reserve != NULL) {
+    rbtree_pnode *next = t->reserve->left;
+    free(t->reserve);
+    t->reserve = next;
+  }
+  pthread_mutex_destroy(&t->lock);
+  free(t);
+}
+
+// key를 삽입하고 성공하면 0을 반환
+int rbtree_persistent_insert(rbtree_persistent *t, const key_t key) {
+  if (t == NULL) return 1;
+  pthread_mutex_lock(&t->lock);
+  int err = rbtree_p_reserve(t);
+  if (!err) {
+    t->root = rbtree_p_insert(t, t->root, key);
+    t->root->color = RBTREE_P_BLACK;
+  }
+  pthread_mutex_unlock(&t->lock);
+  return err;
+}
+
+// key 하나를 삭제하고, 삭제했으면 1을 반환
+int rbtree_persistent_erase(rbtree_persistent *t, const key_t key) {
+  if (t == NULL) return 0;
+  pthread_mutex_lock(&t->lock);
+  int erased = rbtree_p_find(t->root, key) != NULL && !rbtree_p_reserve(t);
+  if (erased) {
+    t->root = rbtree_p_own(t, t->root);
+    if (!rbtree_p_red(t->root->left) && !rbtree_p_red(t->root->right)) t->root->color = RBTREE_P_RED;
+    t->root = rbtree_p_erase(t, t->root, rbtree_p_rank(t->root, key));
+    if (t->root != NULL) t->root->color = RBTREE_P_BLACK;
+  }
+  pthread_mutex_unlock(&t->lock);
+  return erased;
+}
+
+size_t rbtree_persistent_size(rbtree_persistent *t) {
+  if (t == NULL) return 0;
+  pthread_mutex_lock(&t->lock);
+  size_t n = rbtree_p_size(t->root);
+  pthread_mutex_unlock(&t->lock);
+  return n;
+}
+
+// 현재 버전을 고정해 반환하는 메서드 (O(1), 이후의 변경은 경로를 복사하므로 이 버전에 보이지 않음)
+rbtree_version *rbtree_snapshot(rbtree_persistent *t) {
+  if (t == NULL) return NULL;
+  rbtree_version *v = (rbtree_version *)malloc(sizeof(rbtree_version));
+  if (v == NULL) return NULL;
+  pthread_mutex_lock(&t->lock);
+  v->root = t->root;
+  rbtree_p_retain(v->root);
+  pthread_mutex_unlock(&t->lock);
+  return v;
+}
+
+// snapshot을 놓는 메서드 (마지막 참조였던 노드만 반환되며, 어느 thread에서 호출해도 됨)
+void rbtree_snapshot_release(rbtree_version *v) {
+  if (v == NULL) return;
+  rbtree_p_release(v->root);
+  free(v);
+}
+
+// 아래 조회는 고정된 버전만 읽으므로 lock 없이 수행
+size_t rbtree_version_size(const rbtree_version *v) {
+  return v == NULL ? 0 : rbtree_p_size(v->root);
+}
+
+int rbtree_version_find(const rbtree_version *v, const key_t key) {
+  return v != NULL && rbtree_p_find(v->root, key) != NULL;
+}
+
+// key 이상인 첫 key를 out에 쓰고 1을 반환 (없으면 0)
+int rbtree_version_lower_bound(const rbtree_version *v, const key_t key, key_t *out) {
+  const rbtree_pnode *res = NULL;
+  for (const rbtree_pnode *p = v == NULL ? NULL : v->root; p != NULL;) {
+    if (p->key < key) p = p->right;
+    else {
+      res = p;
+      p = p->left;
+    }
+  }
+  if (res != NULL && out != NULL) *out = res->key;
+  return res != NULL;
+}
+
+int rbtree_version_min(const rbtree_version *v, key_t *out) {
+  const rbtree_pnode *p = v == NULL ? NULL : v->root;
+  if (p == NULL) return 0;
+  while (p->left != NULL) p = p->left;
+  if (out != NULL) *out = p->key;
+  return 1;
+}
+
+int rbtree_version_max(const rbtree_version *v, key_t *out) {
+  const rbtree_pnode *p = v == NULL ? NULL : v->root;
+  if (p == NULL) return 0;
+  while (p->right != NULL) p = p->right;
+  if (out != NULL) *out = p->key;
+  return 1;
+}
+
+// 작은 key부터 n개를 arr에 씀 (rbtree_to_array와 같이 재귀 없이 순회)
+int rbtree_version_to_array(const rbtree_version *v, key_t *arr, const size_t n) {
+  if (v == NULL || arr == NULL || n == 0) return 1;
+  const rbtree_pnode *stack[RBTREE_P_MAX_HEIGHT];
+  const rbtree_pnode *p = v->root;
+  size_t i = 0;
+  int top = 0;
+  while (i < n) {
+    for (; p != NULL; p = p->left) stack[top++] = p;
+    if (top == 0) break;
+    p = stack[--top];
+    arr[i++] = p->key;
+    p = p->right;
+  }
+  return 0;
+}
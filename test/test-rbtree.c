@@ -1,8 +1,18 @@
 #include <assert.h>
+#include <limits.h>
+#include <malloc.h>
+#include <pthread.h>
 #include <rbtree.h>
+#include <rbtree_gen.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // new_rbtree should return rbtree struct with null root node
 void test_init(void) {
@@ -28,11 +38,11 @@ void test_insert_single(const key_t key) {
 #ifdef SENTINEL
   assert(p->left == t->nil);
   assert(p->right == t->nil);
-  assert(p->parent == t->nil);
+  assert(rb_parent(p) == t->nil);
 #else
   assert(p->left == NULL);
   assert(p->right == NULL);
-  assert(p->parent == NULL);
+  assert(rb_parent(p) == NULL);
 #endif
   delete_rbtree(t);
 }
@@ -243,12 +253,12 @@ static bool color_traverse(const node_t *p, const color_t parent_color,
     }
     return true;
   }
-  if (parent_color == RBTREE_RED && p->color == RBTREE_RED) {
+  if (parent_color == RBTREE_RED && rb_color(p) == RBTREE_RED) {
     return false;
   }
-  int next_depth = ((p->color == RBTREE_BLACK) ? 1 : 0) + black_depth;
-  return color_traverse(p->left, p->color, next_depth, nil) &&
-         color_traverse(p->right, p->color, next_depth, nil);
+  int next_depth = ((rb_color(p) == RBTREE_BLACK) ? 1 : 0) + black_depth;
+  return color_traverse(p->left, rb_color(p), next_depth, nil) &&
+         color_traverse(p->right, rb_color(p), next_depth, nil);
 }
 
 void test_color_constraint(const rbtree *t) {
@@ -259,7 +269,7 @@ void test_color_constraint(const rbtree *t) {
   node_t *nil = NULL;
 #endif
   node_t *p = t->root;
-  assert(p == nil || p->color == RBTREE_BLACK);
+  assert(p == nil || rb_color(p) == RBTREE_BLACK);
 
   init_color_traverse();
   assert(color_traverse(p, RBTREE_BLACK, 0, nil));
@@ -310,6 +320,64 @@ void test_to_array_suite() {
   delete_rbtree(t);
 }
 
+typedef struct {
+  const key_t *expect;
+  size_t pos, cap, calls, stop_after;
+} stream_arg_t;
+
+// 받은 buffer가 기대한 순서의 다음 key들인지 확인하는 flush 콜백
+static int check_stream(const key_t *buf, size_t len, void *arg) {
+  stream_arg_t *s = (stream_arg_t *)arg;
+  assert(len > 0 && len <= s->cap);
+  for (size_t i = 0; i < len; i++) assert(buf[i] == s->expect[s->pos + i]);
+  s->pos += len;
+  return ++s->calls == s->stop_after;
+}
+
+// 큰 tree의 to_array(thread로 나누는 경로 포함)와 buffer 단위 stream 출력
+void test_export(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  key_t *res = calloc(n + 1, sizeof(key_t));
+  rbtree *t = new_rbtree();
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 2 + 1);
+    rbtree_insert(t, arr[i]);
+  }
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  // 요청한 수만큼만 쓰고 그 뒤는 건드리지 않음
+  const size_t lens[] = {1, 2, t->root->left->size, t->root->left->size + 1, n / 3, n - 1, n};
+  for (int k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+    size_t m = lens[k];
+    res[m] = -1;
+    assert(rbtree_to_array(t, res, m) == 0);
+    for (size_t i = 0; i < m; i++) assert(res[i] == arr[i]);
+    assert(res[m] == -1);
+  }
+  res[n] = -1;
+  assert(rbtree_to_array(t, res, n + 1) == 0);      // tree보다 크면 tree의 key 수만큼만 씀
+  assert(res[n] == -1);
+
+  const size_t caps[] = {1, 7, 4096, n, n + 5};
+  for (int k = 0; k < sizeof(caps) / sizeof(caps[0]); k++) {
+    stream_arg_t s = {arr, 0, caps[k], 0, 0};
+    assert(rbtree_to_array_stream(t, res, caps[k], check_stream, &s) == n);
+    assert(s.pos == n && s.calls == (n + caps[k] - 1) / caps[k]);
+  }
+  stream_arg_t s = {arr, 0, 100, 0, 3};             // 세 번째 flush에서 멈춤
+  assert(rbtree_to_array_stream(t, res, 100, check_stream, &s) == 300 && s.pos == 300);
+  assert(rbtree_to_array_stream(t, res, 0, check_stream, &s) == 0);
+
+  rbtree *e = new_rbtree();
+  s.calls = 0;
+  assert(rbtree_to_array_stream(e, res, 16, check_stream, &s) == 0 && s.calls == 0);
+  delete_rbtree(e);
+  free(res);
+  free(arr);
+  delete_rbtree(t);
+}
+
 void test_find_erase(rbtree *t, const key_t *arr, const size_t n) {
   for (int i = 0; i < n; i++) {
     node_t *p = rbtree_insert(t, arr[i]);
@@ -367,6 +435,1442 @@ void test_find_erase_rand(const size_t n, const unsigned int seed) {
   delete_rbtree(t);
 }
 
+// reserve should pre-allocate nodes and recycle erased ones
+void test_reserve(const size_t n) {
+  rbtree *t = new_rbtree();
+  assert(t != NULL);
+  assert(rbtree_reserve(t, n) == 0);
+
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  for (int i = 0; i < n; i++) {
+    nodes[i] = rbtree_insert(t, (key_t)(i * 7 % n));
+    assert(nodes[i] != NULL);
+  }
+  for (int i = 0; i < n; i += 2) {
+    rbtree_erase(t, nodes[i]);
+  }
+  for (int i = 0; i < n; i += 2) {
+    nodes[i] = rbtree_insert(t, (key_t)i);
+    assert(nodes[i] != NULL);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+
+  free(nodes);
+  delete_rbtree(t);
+}
+
+// bulk build should produce a valid tree holding every key in order
+void test_from_array(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 2 + 1);
+  }
+
+  rbtree *t = rbtree_from_array(arr, n);
+  assert(t != NULL);
+  test_color_constraint(t);
+  test_search_constraint(t);
+
+  qsort((void *)arr, n, sizeof(key_t), comp);
+  key_t *res = calloc(n, sizeof(key_t));
+  rbtree_to_array(t, res, n);
+  for (int i = 0; i < n; i++) {
+    assert(arr[i] == res[i]);
+  }
+  delete_rbtree(t);
+
+  for (size_t m = 0; m <= 33; m++) {
+    t = rbtree_from_sorted(arr, m);
+    assert(t != NULL);
+    test_color_constraint(t);
+    test_search_constraint(t);
+    node_t *p = rbtree_insert(t, arr[0]);
+    assert(p != NULL);
+    rbtree_erase(t, p);
+    test_color_constraint(t);
+    delete_rbtree(t);
+  }
+
+  free(res);
+  free(arr);
+}
+
+// every node should hold the size of its subtree
+static size_t size_traverse(const node_t *p, const node_t *nil) {
+  if (p == nil) {
+    return 0;
+  }
+  const size_t size =
+      size_traverse(p->left, nil) + size_traverse(p->right, nil) + rb_count(p);
+  assert(p->size == size);
+#ifdef RBTREE_INTERVAL
+  key_t max_end = p->end;                           // 서브트리의 가장 큰 end도 함께 확인
+  if (p->left != nil && p->left->max_end > max_end) max_end = p->left->max_end;
+  if (p->right != nil && p->right->max_end > max_end) max_end = p->right->max_end;
+  assert(p->key <= p->end && p->max_end == max_end);
+#endif
+  return size;
+}
+
+// find_batch should match find for every key in the batch
+void test_find_batch(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *keys = calloc(n, sizeof(key_t));
+  node_t **out = calloc(n, sizeof(node_t *));
+  size_t found = rbtree_find_batch(t, keys, 0, out);
+  assert(found == 0);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = rand() % (n * 2);
+    if (i % 2 == 0) rbtree_insert(t, keys[i]);
+  }
+  for (size_t m = 0; m <= n; m += n / 7 + 1) {      // group 크기(16)의 배수가 아닌 길이 포함
+    found = rbtree_find_batch(t, keys, m, out);
+    size_t expected = 0;
+    for (size_t i = 0; i < m; i++) {
+      node_t *p = rbtree_find(t, keys[i]);
+      if (p == NULL) assert(out[i] == NULL);
+      else {
+        assert(out[i] != NULL && out[i]->key == keys[i]);
+        expected++;
+      }
+    }
+    assert(found == expected);
+  }
+  free(out);
+  free(keys);
+  delete_rbtree(t);
+}
+
+// tree가 RB 트리 속성과 서브트리 크기를 만족하고 to_array 결과가 arr[0, n)과 같은지 확인
+static void check_tree(const rbtree *t, const key_t *arr, const size_t n) {
+  test_color_constraint(t);
+  test_search_constraint(t);
+  assert(rbtree_size(t) == n);
+  assert(size_traverse(t->root, t->nil) == n);
+  if (n == 0) {
+    assert(rbtree_min(t) == t->nil && rbtree_max(t) == t->nil);
+    return;
+  }
+  assert(rbtree_min(t)->key == arr[0] && rbtree_prev(t, rbtree_min(t)) == NULL);
+  assert(rbtree_max(t)->key == arr[n - 1] && rbtree_next(t, rbtree_max(t)) == NULL);
+  key_t *res = calloc(n, sizeof(key_t));
+  rbtree_to_array(t, res, n);
+  for (size_t i = 0; i < n; i++) assert(res[i] == arr[i]);
+  free(res);
+}
+
+void test_join_split(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++) arr[i] = rand() % (n / 4 + 1);
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  // split 후 다시 join하면 원래 tree로 돌아와야 함
+  const key_t pivots[] = {-1, 0, arr[n / 3], arr[n / 2], arr[n - 1], arr[n - 1] + 1};
+  for (int i = 0; i < sizeof(pivots) / sizeof(pivots[0]); i++) {
+    rbtree *t = rbtree_from_array(arr, n);
+    for (size_t j = 0; j < n / 8; j++) rbtree_erase(t, rbtree_insert(t, rand()));  // 삽입 순서가 섞인 모양으로
+    rbtree *lo = NULL, *hi = NULL;
+    assert(rbtree_split(t, pivots[i], &lo, &hi) == 0);
+    assert(rbtree_size(t) == 0);
+    size_t m = 0;
+    while (m < n && arr[m] < pivots[i]) m++;
+    check_tree(lo, arr, m);
+    check_tree(hi, arr + m, n - m);
+    delete_rbtree(t);                               // 노드는 lo, hi에 남아 있음
+
+    node_t *p = rbtree_insert(lo, pivots[i] - 1);  // 공유하는 pool에서 할당
+    rbtree_erase(lo, p);
+    assert(rbtree_join(hi, lo) == (m > 0 && n > m));  // 순서가 반대이면 실패
+    assert(rbtree_join(lo, hi) == 0);
+    assert(rbtree_size(hi) == 0);
+    check_tree(lo, arr, n);
+    delete_rbtree(hi);
+    delete_rbtree(lo);
+  }
+
+  // 따로 만든 tree 사이에서 노드를 옮긴 뒤 어느 순서로 삭제해도 안전해야 함
+  rbtree *a = rbtree_from_sorted(arr, n / 2);
+  rbtree *b = rbtree_from_sorted(arr + n / 2, n - n / 2);
+  assert(rbtree_join(a, b) == 0);
+  delete_rbtree(b);
+  check_tree(a, arr, n);
+  rbtree *lo = NULL, *hi = NULL;
+  assert(rbtree_split(a, arr[n / 4], &lo, &hi) == 0);
+  rbtree *c = new_rbtree();
+  for (key_t k = arr[n - 1] + 1; k < arr[n - 1] + 100; k++) rbtree_insert(c, k);
+  assert(rbtree_join(hi, c) == 0);                  // hi가 쓰는 pool에 c의 pool을 합침
+  delete_rbtree(a);
+  delete_rbtree(c);
+  for (key_t k = 0; k < 50; k++) rbtree_erase(hi, rbtree_max(hi));
+  rbtree_clear(lo);
+  rbtree_insert(lo, 0);
+  test_color_constraint(hi);
+  test_search_constraint(hi);
+  size_t m = 0;
+  while (arr[m] < arr[n / 4]) m++;
+  assert(rbtree_size(hi) == n - m + 99 - 50);
+  assert(rbtree_size(lo) == 1);
+  delete_rbtree(lo);
+  delete_rbtree(hi);
+  free(arr);
+}
+
+// 정렬된 a, b를 합쳐 op의 기대 결과를 res에 쓰고 길이를 반환 (0: union, 1: intersection, 2: difference)
+static size_t setop_expected(const key_t *a, size_t na, const key_t *b, size_t nb, int op, key_t *res) {
+  size_t i = 0, j = 0, n = 0;
+  while (i < na || j < nb) {
+    key_t key = j == nb || (i < na && a[i] < b[j]) ? a[i] : b[j];
+    size_t ca = 0, cb = 0;
+    while (i < na && a[i] == key) i++, ca++;
+    while (j < nb && b[j] == key) j++, cb++;
+    size_t c = op == 0 ? (ca > cb ? ca : cb) : op == 1 ? (ca < cb ? ca : cb) : (ca > cb ? ca - cb : 0);
+    while (c-- > 0) res[n++] = key;
+  }
+  return n;
+}
+
+void test_set_operations(const size_t n, const unsigned int seed) {
+  srand(seed);
+  const size_t sizes[][2] = {{0, 0}, {0, 100}, {100, 0}, {1, 1}, {n, n / 100}, {n / 100, n}, {n, n}};
+  for (int k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+    size_t na = sizes[k][0], nb = sizes[k][1];
+    key_t *a = calloc(na + 1, sizeof(key_t));
+    key_t *b = calloc(nb + 1, sizeof(key_t));
+    key_t *res = calloc(na + nb + 1, sizeof(key_t));
+    for (size_t i = 0; i < na; i++) a[i] = rand() % (n / 2 + 1);  // 같은 key가 여러 번 나옴
+    for (size_t i = 0; i < nb; i++) b[i] = rand() % (n / 2 + 1);
+    qsort((void *)a, na, sizeof(key_t), comp);
+    qsort((void *)b, nb, sizeof(key_t), comp);
+    for (int op = 0; op < 3; op++) {
+      rbtree *t1 = rbtree_from_sorted(a, na);
+      rbtree *t2 = new_rbtree();
+      for (size_t i = 0; i < nb; i++) rbtree_insert(t2, b[i]);
+      int ret = op == 0 ? rbtree_union(t1, t2) : op == 1 ? rbtree_intersection(t1, t2) : rbtree_difference(t1, t2);
+      assert(ret == 0);
+      assert(rbtree_size(t2) == 0);
+      delete_rbtree(t2);
+      check_tree(t1, res, setop_expected(a, na, b, nb, op, res));
+      for (size_t i = 0; i < nb; i++) rbtree_insert(t1, b[i]);  // 버린 노드가 free list에 있어야 함
+      test_color_constraint(t1);
+      delete_rbtree(t1);
+    }
+    free(res);
+    free(b);
+    free(a);
+  }
+}
+
+void test_erase_range(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  key_t *res = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++) arr[i] = rand() % (n / 2 + 1);
+  qsort((void *)arr, n, sizeof(key_t), comp);
+  const key_t ranges[][2] = {{0, 0}, {5, 3}, {-10, 0}, {0, 1}, {arr[n / 3], arr[n / 2]}, {arr[n - 1], INT_MAX},
+                             {INT_MIN, INT_MAX}};
+  for (int k = 0; k < sizeof(ranges) / sizeof(ranges[0]); k++) {
+    const key_t lo = ranges[k][0], hi = ranges[k][1];
+    rbtree *t = new_rbtree();
+    for (size_t i = 0; i < n; i++) rbtree_insert(t, arr[(i * 7919) % n]);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++)
+      if (!(lo <= arr[i] && arr[i] < hi)) res[m++] = arr[i];
+    assert(rbtree_erase_range(t, lo, hi) == n - m);
+    check_tree(t, res, m);
+    for (size_t i = 0; i < n - m; i++) assert(rbtree_insert(t, lo) != NULL);  // 반환된 노드를 재사용
+    test_color_constraint(t);
+    assert(rbtree_size(t) == n);
+    delete_rbtree(t);
+  }
+  free(res);
+  free(arr);
+}
+
+void test_pop(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  key_t *res = calloc(n, sizeof(key_t));
+  key_t key;
+  assert(rbtree_pop_min(t, &key) == 0 && rbtree_pop_max(t, &key) == 0);
+  assert(rbtree_pop_min_n(t, res, 10) == 0);
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 2 + 1);
+    rbtree_insert(t, arr[i]);
+  }
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  size_t lo = 0, hi = n;                            // t에 남은 key는 arr[lo, hi)
+  while (lo < hi) {
+    int op = rand() % 3;
+    if (op == 0) {
+      assert(rbtree_pop_min(t, &key) == 1 && key == arr[lo++]);
+    } else if (op == 1) {
+      assert(rbtree_pop_max(t, &key) == 1 && key == arr[--hi]);
+    } else {
+      size_t k = rand() % 300;
+      size_t m = rbtree_pop_min_n(t, res, k);
+      assert(m == (k < hi - lo ? k : hi - lo));
+      for (size_t i = 0; i < m; i++) assert(res[i] == arr[lo++]);
+    }
+    if (rand() % 16 == 0) check_tree(t, arr + lo, hi - lo);
+  }
+  check_tree(t, arr, 0);
+  rbtree_insert(t, 3);
+  rbtree_insert(t, 1);
+  rbtree_insert(t, 2);
+  assert(rbtree_min(t)->key == 1 && rbtree_max(t)->key == 3);
+  free(res);
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_insert_hint(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  key_t *sorted = calloc(n, sizeof(key_t));
+  for (int pattern = 0; pattern < 5; pattern++) {
+    for (size_t i = 0; i < n; i++) {
+      if (pattern == 0) arr[i] = i;                  // 정렬된 stream
+      else if (pattern == 1) arr[i] = n - i;         // 역순
+      else if (pattern == 2) arr[i] = i + rand() % 33;  // 거의 정렬됨 (같은 key 포함)
+      else arr[i] = rand() % (n / 2 + 1);            // 무작위
+      sorted[i] = arr[i];
+    }
+    qsort((void *)sorted, n, sizeof(key_t), comp);
+    rbtree *t = new_rbtree();
+    node_t *hint = NULL;
+    for (size_t i = 0; i < n; i++) {
+      if (pattern == 4 && i > 0) hint = rbtree_select(t, rand() % rbtree_size(t));  // 아무 노드나 hint로
+      hint = rbtree_insert_hint(t, hint, arr[i]);
+      assert(hint != NULL && hint->key == arr[i]);
+    }
+    check_tree(t, sorted, n);
+    delete_rbtree(t);
+  }
+  free(sorted);
+  free(arr);
+}
+
+void test_stats(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  rbtree_stats_t st;
+  rbtree_stats(t, &st);
+  assert(st.nodes == 0 && st.keys == 0 && st.height == 0 && st.black_height == 0);
+
+  // 서로 다른 key만 넣어 노드 수와 key 수가 layout과 관계없이 같도록 함
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++) arr[i] = i;
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = rand() % (i + 1);
+    key_t tmp = arr[i];
+    arr[i] = arr[j];
+    arr[j] = tmp;
+  }
+  for (size_t i = 0; i < n; i++) rbtree_insert(t, arr[i]);
+  rbtree_stats(t, &st);
+  assert(st.nodes == n && st.keys == n);
+  assert(st.depth_hist[0] == 1);
+  size_t total = 0;
+  int deepest = 0;
+  for (int d = 0; d < RBTREE_STATS_MAX_DEPTH; d++) {
+    total += st.depth_hist[d];
+    if (st.depth_hist[d] > 0) deepest = d;
+    assert(d == 0 || st.depth_hist[d] <= 2 * st.depth_hist[d - 1]);
+  }
+  assert(total == n && deepest + 1 == st.height);
+  assert(st.black_height <= st.height && st.height <= 2 * st.black_height);
+  int lg = 0;
+  while (((size_t)1 << lg) <= n) lg++;
+  assert(st.height <= 2 * lg);
+
+#ifdef RBTREE_STATS
+  assert(st.counters.allocs == n && st.counters.frees == 0);
+  assert(st.counters.comparisons > 0 && st.counters.rotations > 0 && st.counters.insert_fixups > 0);
+  rbtree_stats_reset(t);
+  rbtree_stats(t, &st);
+  assert(st.counters.comparisons == 0 && st.counters.rotations == 0 && st.counters.allocs == 0);
+
+  // 찾기는 루트부터 찾은 노드까지의 노드 수만큼 비교
+  int height = st.height;
+  for (size_t i = 0; i < n; i++) assert(rbtree_find(t, arr[i]) != NULL);
+  rbtree_stats(t, &st);
+  assert(st.counters.comparisons >= n && st.counters.comparisons <= (uint64_t)n * height);
+  assert(st.counters.rotations == 0);
+
+  for (size_t i = 0; i < n; i++) rbtree_erase(t, rbtree_find(t, arr[i]));
+  rbtree_stats(t, &st);
+  assert(st.counters.frees == n && st.counters.erase_fixups > 0);
+
+  // split/join이 임시 tree에서 한 재조정도 원래 tree의 counter에 남음
+  for (size_t i = 0; i < n; i++) rbtree_insert(t, arr[i]);
+  uint64_t fixups = 0;
+  for (int i = 0; i < 16; i++) {
+    rbtree *lo, *hi;
+    rbtree_stats_reset(t);
+    assert(rbtree_split(t, arr[i], &lo, &hi) == 0);
+    rbtree_stats(t, &st);
+    fixups += st.counters.insert_fixups;
+    assert(rbtree_join(lo, hi) == 0);
+    rbtree_stats(lo, &st);
+    fixups += st.counters.insert_fixups + st.counters.erase_fixups;
+    delete_rbtree(t);
+    delete_rbtree(hi);
+    t = lo;
+  }
+  assert(fixups > 0);
+  rbtree_stats_reset(t);
+  for (size_t i = 0; i < n; i++) rbtree_erase(t, rbtree_find(t, arr[i]));
+  rbtree_stats(t, &st);
+#else
+  rbtree_stats_reset(t);
+  for (size_t i = 0; i < n; i++) rbtree_erase(t, rbtree_find(t, arr[i]));
+  rbtree_stats(t, &st);
+  assert(st.counters.comparisons == 0 && st.counters.rotations == 0);
+#endif
+  assert(st.nodes == 0 && st.height == 0);
+  free(arr);
+  delete_rbtree(t);
+}
+
+// rank/select should agree with the sorted order of the keys
+void test_order_statistic(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % n;
+    rbtree_insert(t, arr[i]);
+  }
+  for (int i = 0; i < n; i += 3) {
+    rbtree_erase(t, rbtree_find(t, arr[i]));
+    arr[i] = arr[n - 1];
+  }
+  size_t m = 0;
+  for (int i = 0; i < n; i++) {
+    if (i % 3 != 0) {
+      arr[m++] = arr[i];
+    }
+  }
+  assert(rbtree_size(t) == m);
+  assert(size_traverse(t->root, t->nil) == m);
+  test_color_constraint(t);
+
+  qsort((void *)arr, m, sizeof(key_t), comp);
+  for (int i = 0; i < m; i++) {
+    node_t *p = rbtree_select(t, i);
+    assert(p != NULL);
+    assert(p->key == arr[i]);
+    size_t rank = rbtree_rank(t, arr[i]);
+    assert(rank <= i && arr[rank] == arr[i]);
+    assert(rank == 0 || arr[rank - 1] < arr[i]);
+  }
+  assert(rbtree_select(t, m) == NULL);
+  assert(rbtree_rank(t, n) == m);
+
+  free(arr);
+  delete_rbtree(t);
+
+  key_t sorted[] = {1, 2, 2, 3, 5, 8, 13};
+  t = rbtree_from_sorted(sorted, 7);
+  assert(rbtree_size(t) == 7);
+  assert(size_traverse(t->root, t->nil) == 7);
+  assert(rbtree_rank(t, 3) == 3);
+  assert(rbtree_select(t, 4)->key == 5);
+  delete_rbtree(t);
+}
+
+static int sum_visit(node_t *p, void *arg) {
+  *(long *)arg += (long)p->key * rb_count(p);
+  return 0;
+}
+
+// next/prev and bounds should walk the keys in sorted order
+void test_iterator(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % n;
+    rbtree_insert(t, arr[i]);
+  }
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  int i = 0;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+    for (int c = 0; c < rb_count(p); c++) {
+      assert(p->key == arr[i++]);
+    }
+  }
+  assert(i == n);
+  for (node_t *p = rbtree_max(t); p != NULL; p = rbtree_prev(t, p)) {
+    for (int c = 0; c < rb_count(p); c++) {
+      assert(p->key == arr[--i]);
+    }
+  }
+  assert(i == 0);
+
+  const key_t lo = n / 4, hi = n / 2;
+  node_t *lb = rbtree_lower_bound(t, lo);
+  node_t *ub = rbtree_upper_bound(t, lo);
+  size_t first = 0, last = 0;
+  while (first < n && arr[first] < lo) first++;
+  last = first;
+  while (last < n && arr[last] <= lo) last++;
+  assert(lb != NULL && lb->key == arr[first]);
+  assert(ub != NULL && ub->key == arr[last]);
+  assert(rbtree_upper_bound(t, arr[n - 1]) == NULL);
+  assert(rbtree_lower_bound(t, arr[0])->key == arr[0]);
+
+  long sum = 0, expected = 0;
+  size_t cnt = 0;
+  for (int j = 0; j < n; j++) {
+    if (arr[j] >= lo && arr[j] < hi) {
+      expected += arr[j];
+      cnt++;
+    }
+  }
+  assert(rbtree_range_scan(t, lo, hi, sum_visit, &sum) == cnt);
+  assert(sum == expected);
+  assert(rbtree_range_scan(t, hi, lo, sum_visit, &sum) == 0);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+// frozen snapshot should answer bounds exactly like the sorted keys
+void test_freeze(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(n + 2, sizeof(key_t));
+  size_t m = n;
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % (n + 1);
+    rbtree_insert(t, arr[i]);
+  }
+  if (n > 2) {
+    arr[m++] = INT_MAX;
+    arr[m++] = INT_MIN;
+    rbtree_insert(t, INT_MAX);
+    rbtree_insert(t, INT_MIN);
+  }
+  qsort((void *)arr, m, sizeof(key_t), comp);
+
+  rbtree_frozen *f = rbtree_freeze(t);
+  assert(f != NULL);
+  assert(f->n == m);
+  for (int j = 0; j < m; j++) {
+    assert(f->level[0][j] == arr[j]);
+  }
+
+  const key_t probes[] = {INT_MIN, INT_MAX, -1, 0, 1};
+  for (int q = -5; q < (int)n + 2; q++) {
+    const key_t key = q < 0 ? probes[q + 5] : q;
+    size_t lb = 0, ub = 0;
+    while (lb < m && arr[lb] < key) lb++;
+    ub = lb;
+    while (ub < m && arr[ub] <= key) ub++;
+    assert(rbtree_frozen_lower_bound(f, key) == lb);
+    assert(rbtree_frozen_upper_bound(f, key) == ub);
+    const key_t *p = rbtree_frozen_find(f, key);
+    assert((p == NULL) == (lb == ub));
+    assert(p == NULL || *p == key);
+
+    size_t cnt;
+    const key_t *r = rbtree_frozen_range(f, key, key + (key < INT_MAX), &cnt);
+    assert(cnt == (key < INT_MAX ? ub - lb : 0));
+    assert(cnt == 0 || *r == key);
+  }
+
+  delete_rbtree_frozen(f);
+  free(arr);
+  delete_rbtree(t);
+}
+
+void test_freeze_suite() {
+  const size_t sizes[] = {0, 1, 15, 16, 17, 255, 256, 257, 5000};
+  for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    test_freeze(sizes[i], 41 + i);
+  }
+}
+
+// 파일의 off 위치 byte를 뒤집는 함수
+static void flip_byte(const char *path, long off) {
+  FILE *fp = fopen(path, "r+b");
+  assert(fp != NULL);
+  fseek(fp, off, SEEK_SET);
+  int c = fgetc(fp);
+  fseek(fp, off, SEEK_SET);
+  fputc(c ^ 0x5a, fp);
+  fclose(fp);
+}
+
+void test_save_load(const size_t n, const unsigned int seed) {
+  srand(seed);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/test-rbtree-%d.bin", (int)getpid());
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  rbtree *t = new_rbtree();
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = rand() % (n / 2 + 1) - (int)(n / 4);  // 음수와 같은 key 포함
+    rbtree_insert(t, arr[i]);
+  }
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  assert(rbtree_save(t, path) == 0);
+  rbtree *u = rbtree_load(path);
+  assert(u != NULL);
+  check_tree(u, arr, n);
+  delete_rbtree(u);
+
+  // 불러온 tree도 보통의 tree처럼 바뀌어야 함
+  u = rbtree_load(path);
+  rbtree_insert(u, INT_MAX);
+  arr[n] = INT_MAX;
+  check_tree(u, arr, n + 1);
+  delete_rbtree(u);
+
+  // 손상되거나 잘린 파일은 거부
+  if (n > 0) {
+    flip_byte(path, sizeof(rbtree_file_header_t) + (n / 2) * sizeof(key_t));
+    assert(rbtree_load(path) == NULL);
+    assert(rbtree_save(t, path) == 0);
+    assert(truncate(path, sizeof(rbtree_file_header_t) + (n - 1) * sizeof(key_t)) == 0);
+    assert(rbtree_load(path) == NULL);
+  }
+  assert(rbtree_save(t, path) == 0);
+  flip_byte(path, 0);
+  assert(rbtree_load(path) == NULL);
+  assert(truncate(path, sizeof(rbtree_file_header_t) - 1) == 0);
+  assert(rbtree_load(path) == NULL);
+
+  unlink(path);
+  assert(rbtree_load(path) == NULL);
+  assert(rbtree_save(t, "/nonexistent-dir/rbtree.bin") == 1);
+  free(arr);
+  delete_rbtree(t);
+}
+
+// 두 tree가 같은 key를 담고 있는지 확인하는 함수
+static void assert_same_keys(const rbtree *a, const rbtree *b) {
+  size_t n = rbtree_size(a);
+  assert(rbtree_size(b) == n);
+  key_t *x = calloc(n + 1, sizeof(key_t)), *y = calloc(n + 1, sizeof(key_t));
+  rbtree_to_array(a, x, n);
+  rbtree_to_array(b, y, n);
+  assert(memcmp(x, y, n * sizeof(key_t)) == 0);
+  test_color_constraint(b);
+  free(x);
+  free(y);
+}
+
+static void copy_file(const char *from, const char *to) {
+  FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+  assert(in != NULL && out != NULL);
+  char buf[4096];
+  size_t r;
+  while ((r = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, r, out);
+  fclose(in);
+  fclose(out);
+}
+
+// ref에도 같은 변경을 하면서 w에 무작위로 삽입/삭제하는 함수
+static void wal_mutate(rbtree_wal *w, rbtree *ref, const size_t n, const key_t range) {
+  for (size_t i = 0; i < n; i++) {
+    key_t key = rand() % range;
+    if (rand() % 3) {
+      assert(rbtree_wal_insert(w, key) != NULL);
+      rbtree_insert(ref, key);
+    } else {
+      node_t *p = rbtree_find(rbtree_wal_tree(w), key);
+      if (p == NULL) continue;
+      assert(rbtree_wal_erase(w, p) == 1);
+      rbtree_erase(ref, rbtree_find(ref, key));
+    }
+  }
+}
+
+void test_wal(const size_t n, const unsigned int seed) {
+  srand(seed);
+  char snap[64], log[64], bak[64];
+  snprintf(snap, sizeof(snap), "/tmp/test-rbtree-%d.snap", (int)getpid());
+  snprintf(log, sizeof(log), "/tmp/test-rbtree-%d.log", (int)getpid());
+  snprintf(bak, sizeof(bak), "/tmp/test-rbtree-%d.bak", (int)getpid());
+  unlink(snap);
+  unlink(log);
+  rbtree *ref = new_rbtree();
+  rbtree_wal_stats_t st;
+
+  // snapshot 없이 log만으로 복구
+  rbtree_wal *w = rbtree_wal_open(snap, log, 1024, 0);
+  assert(w != NULL && rbtree_size(rbtree_wal_tree(w)) == 0);
+  wal_mutate(w, ref, n, n / 2);
+  rbtree_wal_stats(w, &st);
+  uint64_t records = st.records;
+  assert(records > 0 && st.syncs > 0 && st.replayed == 0);
+  delete_rbtree_wal(w);
+  w = rbtree_wal_open(snap, log, 1024, 0);
+  assert(w != NULL);
+  rbtree_wal_stats(w, &st);
+  assert(st.replayed == records);
+  assert_same_keys(ref, rbtree_wal_tree(w));
+
+  // checkpoint 이후의 변경만 다시 적용
+  assert(rbtree_wal_checkpoint(w) == 0);
+  wal_mutate(w, ref, n / 4, n / 2);
+  rbtree_wal_stats(w, &st);
+  records = st.records;
+  delete_rbtree_wal(w);
+  w = rbtree_wal_open(snap, log, 1024, 0);
+  rbtree_wal_stats(w, &st);
+  assert(st.replayed == records);                   // records는 다시 연 뒤의 변경만 셈
+  assert_same_keys(ref, rbtree_wal_tree(w));
+
+  // snapshot은 바뀌었지만 log를 비우기 전에 멈춘 경우: 이전 log를 다시 적용하지 않음
+  wal_mutate(w, ref, n / 4, n / 2);
+  assert(rbtree_wal_sync(w) == 0);
+  copy_file(log, bak);
+  assert(rbtree_wal_checkpoint(w) == 0);
+  delete_rbtree_wal(w);
+  copy_file(bak, log);
+  w = rbtree_wal_open(snap, log, 1024, 0);
+  rbtree_wal_stats(w, &st);
+  assert(st.replayed == 0);
+  assert_same_keys(ref, rbtree_wal_tree(w));
+
+  // 끝이 잘린 record는 버리고 이어서 기록
+  wal_mutate(w, ref, 100, n / 2);
+  delete_rbtree_wal(w);
+  FILE *fp = fopen(log, "ab");
+  fwrite("\1\0\0\0\7", 1, 5, fp);
+  fclose(fp);
+  w = rbtree_wal_open(snap, log, 1024, 0);
+  assert(w != NULL);
+  assert_same_keys(ref, rbtree_wal_tree(w));
+  wal_mutate(w, ref, 100, n / 2);
+  delete_rbtree_wal(w);
+  w = rbtree_wal_open(snap, log, 1024, 0);
+  assert_same_keys(ref, rbtree_wal_tree(w));
+  delete_rbtree_wal(w);
+
+  // byte 기준에 닿지 않아도 sync_ms가 지나면 기록됨
+  w = rbtree_wal_open(snap, log, 1 << 20, 1);
+  assert(rbtree_wal_insert(w, 1) != NULL);
+  rbtree_insert(ref, 1);
+  for (int i = 0; i < 1000; i++) {
+    rbtree_wal_stats(w, &st);
+    if (st.syncs > 0) break;
+    usleep(1000);
+  }
+  assert(st.syncs > 0);
+  delete_rbtree_wal(w);
+
+  // sync_bytes가 0이면 byte 기준 없이 sync_ms마다 묶어서 기록 (변경마다 fsync하지 않음)
+  w = rbtree_wal_open(snap, log, 0, 50);
+  assert(w != NULL);
+  wal_mutate(w, ref, 1000, n / 2);
+  rbtree_wal_stats(w, &st);
+  assert(st.records > 500 && st.syncs * 10 < st.records);
+  delete_rbtree_wal(w);
+  w = rbtree_wal_open(snap, log, 1024, 0);
+  assert_same_keys(ref, rbtree_wal_tree(w));
+  delete_rbtree_wal(w);
+
+  // replay 중 노드를 할당하지 못하면 열기에 실패하고, 이미 기록된 log는 잘라내지 않음
+  const size_t m = 200000;
+  unlink(snap);
+  unlink(log);
+  w = rbtree_wal_open(snap, log, 1 << 20, 0);
+  for (size_t i = 0; i < m; i++) assert(rbtree_wal_insert(w, (key_t)i) != NULL);
+  delete_rbtree_wal(w);
+  struct stat before, after;
+  assert(stat(log, &before) == 0);
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)  // sanitizer는 주소 공간을 미리 크게 잡으므로 RLIMIT_AS로 제한할 수 없음
+  pid_t pid = fork();
+  if (pid == 0) {                                   // log를 mmap하고 노드 일부만 만들 수 있는 주소 공간으로 열기
+    malloc_trim(0);
+    unsigned long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL || fscanf(statm, "%lu", &pages) != 1) _exit(2);
+    fclose(statm);
+    struct rlimit rl;
+    rl.rlim_cur = rl.rlim_max = pages * sysconf(_SC_PAGESIZE) + 2 * before.st_size + (1 << 20);
+    if (setrlimit(RLIMIT_AS, &rl) != 0) _exit(2);
+    _exit(rbtree_wal_open(snap, log, 1 << 20, 0) == NULL ? 0 : 1);
+  }
+  int status;
+  assert(pid > 0 && waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+#endif
+  assert(stat(log, &after) == 0 && after.st_size == before.st_size);
+  w = rbtree_wal_open(snap, log, 1 << 20, 0);
+  rbtree_wal_stats(w, &st);
+  assert(st.replayed == m && rbtree_size(rbtree_wal_tree(w)) == m);
+  assert(rbtree_wal_checkpoint(w) == 0);
+  delete_rbtree_wal(w);
+
+  // 다른 형식의 log 파일은 열지 않음
+  copy_file(snap, log);
+  assert(rbtree_wal_open(snap, log, 1024, 0) == NULL);
+
+  unlink(snap);
+  unlink(log);
+  unlink(bak);
+  delete_rbtree(ref);
+}
+
+typedef struct {
+  rbtree_mt *m;
+  int id;
+  size_t n;
+} mt_arg_t;
+
+// each writer inserts its own keys, then erases every other one
+static void *mt_writer(void *arg) {
+  mt_arg_t *a = (mt_arg_t *)arg;
+  for (int i = 0; i < a->n; i++) {
+    assert(rbtree_mt_insert(a->m, i * 8 + a->id) == 0);
+  }
+  for (int i = 0; i < a->n; i += 2) {
+    assert(rbtree_mt_erase(a->m, i * 8 + a->id) == 1);
+  }
+  return NULL;
+}
+
+// readers look up keys that are never erased while writers are running
+static void *mt_reader(void *arg) {
+  mt_arg_t *a = (mt_arg_t *)arg;
+  key_t key;
+  for (int i = 0; i < a->n; i++) {
+    assert(rbtree_mt_find(a->m, -1 - i % 100));
+    assert(rbtree_mt_min(a->m, &key) && key == -100);
+    rbtree_mt_max(a->m, &key);
+    rbtree_mt_find(a->m, i * 8 + a->id % 4);
+  }
+  return NULL;
+}
+
+// concurrent writers and readers should leave a consistent tree
+void test_mt(const size_t n) {
+  rbtree_mt *m = new_rbtree_mt();
+  assert(m != NULL);
+  for (int i = 1; i <= 100; i++) {
+    rbtree_mt_insert(m, -i);
+  }
+
+  pthread_t tid[8];
+  mt_arg_t args[8];
+  for (int i = 0; i < 8; i++) {
+    args[i] = (mt_arg_t){m, i, n};
+    pthread_create(&tid[i], NULL, i < 4 ? mt_writer : mt_reader, &args[i]);
+  }
+  for (int i = 0; i < 8; i++) {
+    pthread_join(tid[i], NULL);
+  }
+
+  assert(rbtree_mt_size(m) == 100 + 4 * (n / 2));
+  key_t *res = calloc(100 + 4 * n, sizeof(key_t));
+  rbtree_mt_to_array(m, res, 100 + 4 * (n / 2));
+  for (int i = 1; i < 100 + 4 * (n / 2); i++) {
+    assert(res[i - 1] < res[i]);
+  }
+  assert(rbtree_mt_range_scan(m, 0, 8 * n, NULL, NULL) == 4 * (n / 2));
+  for (int i = 0; i < 4; i++) {
+    assert(!rbtree_mt_find(m, i));
+    assert(rbtree_mt_find(m, 8 + i));
+  }
+
+  free(res);
+  delete_rbtree_mt(m);
+}
+
+static int count_visit(node_t *p, void *arg) {
+  return --*(int *)arg == 0;
+}
+
+typedef struct {
+  rbtree_sharded *s;
+  int id;
+  size_t n;
+} sharded_arg_t;
+
+static void *sharded_writer(void *arg) {
+  sharded_arg_t *a = (sharded_arg_t *)arg;
+  for (int i = 0; i < a->n; i++) {
+    assert(rbtree_sharded_insert(a->s, i * 4 + a->id) == 0);
+  }
+  return NULL;
+}
+
+// 쓰기와 겹쳐서 경계를 계속 다시 정하는 thread
+static void *sharded_rebalancer(void *arg) {
+  sharded_arg_t *a = (sharded_arg_t *)arg;
+  key_t sample[64];
+  for (int r = 0; r < 50; r++) {
+    for (int i = 0; i < 64; i++) sample[i] = rand() % (int)(a->n * 4 + 1);
+    assert(rbtree_sharded_rebalance(a->s, sample, 64) == 0);
+  }
+  return NULL;
+}
+
+// sharded tree should behave like one ordered multiset across rebalances
+void test_sharded(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree_sharded *s = new_rbtree_sharded(4, NULL);
+  assert(s != NULL);
+  key_t *arr = calloc(n, sizeof(key_t));
+  key_t *res = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() - RAND_MAX / 2;
+    assert(rbtree_sharded_insert(s, arr[i]) == 0);
+  }
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  for (int round = 0; round < 2; round++) {
+    assert(rbtree_sharded_size(s) == n);
+    rbtree_sharded_to_array(s, res, n);
+    for (int i = 0; i < n; i++) {
+      assert(arr[i] == res[i]);
+    }
+    key_t key;
+    assert(rbtree_sharded_min(s, &key) && key == arr[0]);
+    assert(rbtree_sharded_max(s, &key) && key == arr[n - 1]);
+    assert(rbtree_sharded_find(s, arr[n / 2]));
+    assert(rbtree_sharded_range_scan(s, arr[n / 4], arr[3 * n / 4], NULL, NULL) >= n / 2 - 1);
+    assert(rbtree_sharded_range_scan(s, INT_MIN, INT_MAX, NULL, NULL) == n);
+    int limit = 10;
+    assert(rbtree_sharded_range_scan(s, INT_MIN, INT_MAX, count_visit, &limit) == 10);
+    rbtree_sharded_rebalance(s, arr, n / 10);
+  }
+
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_sharded_erase(s, arr[i]) == 1);
+  }
+  assert(rbtree_sharded_size(s) == 0);
+  assert(!rbtree_sharded_min(s, NULL));
+  delete_rbtree_sharded(s);
+
+  const key_t bounds[] = {100, 200, 300};
+  s = new_rbtree_sharded(4, bounds);
+  pthread_t tid[6];
+  sharded_arg_t args[6];
+  for (int i = 0; i < 6; i++) {                     // writer 4개와 동시에 rebalance하는 thread 2개
+    args[i] = (sharded_arg_t){s, i, n / 4};
+    pthread_create(&tid[i], NULL, i < 4 ? sharded_writer : sharded_rebalancer, &args[i]);
+  }
+  for (int i = 0; i < 6; i++) {
+    pthread_join(tid[i], NULL);
+  }
+  rbtree_sharded_to_array(s, res, n / 4 * 4);
+  for (int i = 0; i < n / 4 * 4; i++) {
+    assert(res[i] == i);
+  }
+  delete_rbtree_sharded(s);
+
+  free(res);
+  free(arr);
+}
+
+#ifdef RBTREE_COUNTED
+// duplicates should share one node whose count follows insert/erase
+void test_counted(const size_t n) {
+  rbtree *t = new_rbtree();
+  node_t *p = NULL;
+  for (int i = 0; i < n; i++) {
+    node_t *q = rbtree_insert(t, i % 3);
+    assert(q != NULL && q->key == i % 3);
+    if (i == 0) p = q;
+  }
+  assert(rbtree_insert(t, 0) == p);
+  assert(rbtree_size(t) == n + 1);
+  assert(p->count == (n + 2) / 3 + 1);
+  test_color_constraint(t);
+  assert(size_traverse(t->root, t->nil) == n + 1);
+
+  key_t *res = calloc(n + 1, sizeof(key_t));
+  rbtree_to_array(t, res, n + 1);
+  for (int i = 1; i <= n; i++) {
+    assert(res[i - 1] <= res[i]);
+  }
+  assert(rbtree_rank(t, 1) == p->count);
+  assert(rbtree_select(t, p->count)->key == 1);
+
+  const size_t cnt = p->count;
+  for (int i = 0; i < cnt; i++) {
+    assert(rbtree_find(t, 0) == p);
+    assert(rbtree_erase(t, p) == 1);
+  }
+  assert(rbtree_find(t, 0) == NULL);
+  assert(rbtree_size(t) == n + 1 - cnt);
+
+  rbtree *u = rbtree_from_sorted(res, n + 1);
+  assert(rbtree_size(u) == n + 1);
+  assert(u->root->size == n + 1);
+  assert(rbtree_range_scan(u, 0, 3, NULL, NULL) == n + 1);
+  test_color_constraint(u);
+  delete_rbtree(u);
+
+  free(res);
+  delete_rbtree(t);
+}
+#endif
+
+// 64비트 key에 payload를 함께 저장하는 트리와 문자열 prefix를 key로 쓰는 트리
+typedef struct {
+  uint64_t id;
+  int qty;
+} order_t;
+
+RBTREE_GENERATE(u64map, uint64_t, order_t, RBTREE_LESS)
+
+typedef struct {
+  char s[8];
+} prefix_t;
+
+#define PREFIX_LESS(a, b) (memcmp((a).s, (b).s, sizeof((a).s)) < 0)
+RBTREE_GENERATE(prefixmap, prefix_t, int, PREFIX_LESS)
+
+// 침입형 트리의 black height를 반환 (RB 트리 속성을 위반하면 assert)
+int intrusive_black_height(const rbtree_intrusive *t, const rbtree_link *p) {
+  if (p == t->nil) return 1;
+  assert(p->left == t->nil || p->left->parent == p);
+  assert(p->right == t->nil || p->right->parent == p);
+  if (p->color == RBTREE_GEN_RED) {
+    assert(p->left->color == RBTREE_GEN_BLACK);
+    assert(p->right->color == RBTREE_GEN_BLACK);
+  }
+  int l = intrusive_black_height(t, p->left);
+  int r = intrusive_black_height(t, p->right);
+  assert(l == r);
+  return l + (p->color == RBTREE_GEN_BLACK);
+}
+
+void test_generic(const size_t n, const unsigned int seed) {
+  srand(seed);
+  u64map *t = u64map_new();
+  assert(t != NULL);
+  uint64_t *keys = calloc(n, sizeof(uint64_t));
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = ((uint64_t)rand() << 32) | (uint64_t)i;  // 32비트를 넘는 서로 다른 key
+    order_t o = {keys[i], (int)i};
+    assert(u64map_insert(t, keys[i], o) != NULL);
+  }
+  assert(u64map_size(t) == n);
+  assert(t->tree.root->color == RBTREE_GEN_BLACK);
+  intrusive_black_height(&t->tree, t->tree.root);
+
+  for (size_t i = 0; i < n; i++) {
+    u64map_node *p = u64map_find(t, keys[i]);
+    assert(p != NULL);
+    assert(p->value.id == keys[i] && p->value.qty == (int)i);
+  }
+  assert(u64map_find(t, (uint64_t)n) == NULL);       // 하위 32비트가 n인 key는 없음
+
+  for (size_t i = 0; i < n; i += 2) {
+    assert(u64map_erase(t, u64map_find(t, keys[i])) == 1);
+  }
+  assert(u64map_size(t) == n / 2);
+  intrusive_black_height(&t->tree, t->tree.root);
+
+  size_t cnt = 0;
+  uint64_t last = 0;
+  for (u64map_node *p = u64map_min(t); p != NULL; p = u64map_next(t, p), cnt++) {
+    assert(cnt == 0 || last < p->key);
+    assert(p->value.qty % 2 == 1);
+    last = p->key;
+  }
+  assert(cnt == n / 2);
+  assert(u64map_max(t)->key == last);
+  assert(u64map_prev(t, u64map_min(t)) == NULL);
+  u64map_delete(t);
+  free(keys);
+
+  prefixmap *pt = prefixmap_new();
+  const char *words[] = {"pear", "apple", "fig", "banana", "cherry"};
+  for (int i = 0; i < 5; i++) {
+    prefix_t k = {{0}};
+    strncpy(k.s, words[i], sizeof(k.s));
+    prefixmap_insert(pt, k, i);
+  }
+  prefix_t k = {{0}};
+  strncpy(k.s, "c", sizeof(k.s));
+  prefixmap_node *p = prefixmap_lower_bound(pt, k);
+  assert(p != NULL && strcmp(p->key.s, "cherry") == 0 && p->value == 4);
+  assert(strcmp(prefixmap_min(pt)->key.s, "apple") == 0);
+  assert(strcmp(prefixmap_max(pt)->key.s, "pear") == 0);
+  prefixmap_delete(pt);
+}
+
+// 두 트리에 동시에 들어가는 caller 소유 객체 (id는 서로 다름, price는 중복 가능)
+typedef struct {
+  int id;
+  int price;
+  rbtree_link by_id, by_price;
+} item_t;
+
+#define ITEM_ID(o) ((o)->id)
+#define ITEM_PRICE(o) ((o)->price)
+RBTREE_GENERATE_INTRUSIVE(item_by_id, item_t, by_id, int, ITEM_ID, RBTREE_LESS)
+RBTREE_GENERATE_INTRUSIVE(item_by_price, item_t, by_price, int, ITEM_PRICE, RBTREE_LESS)
+
+void test_intrusive(const size_t n, const unsigned int seed) {
+  srand(seed);
+  item_t *items = calloc(n, sizeof(item_t));       // 트리는 이 배열 밖의 메모리를 쓰지 않음
+  rbtree_intrusive ids, prices;
+  rbtree_intrusive_init(&ids);
+  rbtree_intrusive_init(&prices);
+  assert(item_by_id_min(&ids) == NULL && rbtree_intrusive_size(&ids) == 0);
+
+  for (size_t i = 0; i < n; i++) {
+    items[i].id = (int)((i * 7919) % n);            // n과 서로소인 수를 곱해 섞은 서로 다른 id
+    items[i].price = rand() % 100;
+    assert(item_by_id_insert(&ids, &items[i]) == &items[i]);
+    assert(item_by_price_insert(&prices, &items[i]) == &items[i]);
+  }
+  assert(rbtree_intrusive_size(&ids) == n && rbtree_intrusive_size(&prices) == n);
+  assert(ids.root->color == RBTREE_GEN_BLACK);
+  intrusive_black_height(&ids, ids.root);
+  intrusive_black_height(&prices, prices.root);
+
+  // 각 트리는 자기 key 순서로 같은 객체들을 순회
+  size_t cnt = 0;
+  for (item_t *p = item_by_id_min(&ids); p != NULL; p = item_by_id_next(&ids, p), cnt++) assert(p->id == (int)cnt);
+  assert(cnt == n);
+  cnt = 0;
+  for (item_t *p = item_by_price_max(&prices), *q = NULL; p != NULL; q = p, p = item_by_price_prev(&prices, p), cnt++)
+    assert(q == NULL || q->price >= p->price);
+  assert(cnt == n);
+
+  for (size_t i = 0; i < n; i++) {
+    item_t *p = item_by_id_find(&ids, items[i].id);
+    assert(p == &items[i]);
+    item_t *q = item_by_price_lower_bound(&prices, p->price);
+    assert(q != NULL && q->price == p->price);
+    assert(item_by_price_prev(&prices, q) == NULL || item_by_price_prev(&prices, q)->price < p->price);
+  }
+  assert(item_by_id_find(&ids, (int)n) == NULL);
+  assert(item_by_price_lower_bound(&prices, 100) == NULL);
+
+  // 짝수 id를 두 트리에서 모두 떼어내도 객체는 그대로 남음
+  for (size_t i = 0; i < n; i++) {
+    if (items[i].id % 2 != 0) continue;
+    assert(item_by_id_erase(&ids, &items[i]) == 1);
+    assert(item_by_price_erase(&prices, &items[i]) == 1);
+    assert(items[i].by_id.parent == NULL && items[i].by_price.parent == NULL);
+  }
+  assert(rbtree_intrusive_size(&ids) == n / 2 && rbtree_intrusive_size(&prices) == n / 2);
+  intrusive_black_height(&ids, ids.root);
+  intrusive_black_height(&prices, prices.root);
+  for (size_t i = 0; i < n; i++) {
+    item_t *p = item_by_id_find(&ids, items[i].id);
+    assert(items[i].id % 2 == 0 ? p == NULL : p == &items[i]);
+  }
+
+  // 떼어낸 객체는 다시 넣을 수 있음
+  for (size_t i = 0; i < n; i++)
+    if (items[i].id % 2 == 0) item_by_id_insert(&ids, &items[i]);
+  assert(rbtree_intrusive_size(&ids) == n);
+  intrusive_black_height(&ids, ids.root);
+  for (item_t *p = item_by_id_min(&ids), *next; p != NULL; p = next) {  // 떼어내면 link가 비므로 다음 객체를 먼저 찾음
+    next = item_by_id_next(&ids, p);
+    assert(item_by_id_erase(&ids, p) == 1);
+  }
+  assert(rbtree_intrusive_size(&ids) == 0 && ids.root == ids.nil);
+  free(items);
+}
+
+typedef struct {
+  key_t lo, hi, last;
+  size_t visited, limit;
+} overlap_arg_t;
+
+static int check_overlap(node_t *p, void *arg) {
+  overlap_arg_t *a = (overlap_arg_t *)arg;
+  assert(p->key <= a->hi && rb_end(p) >= a->lo);
+  assert(a->visited == 0 || a->last <= p->key);     // key 순서대로 방문
+  a->last = p->key;
+  return ++a->visited == a->limit;
+}
+
+// rbtree_overlaps가 겹치는 구간을 모두 찾는지 전체 탐색과 비교 (RBTREE_INTERVAL이 아니면 점 구간)
+static void check_overlaps(const rbtree *t, node_t **nodes, const size_t n, const key_t range) {
+  for (int q = 0; q < 200; q++) {
+    key_t lo = rand() % range, hi = lo + rand() % (range / 50 + 1);
+    size_t expected = 0;
+    for (size_t i = 0; i < n; i++)
+      if (nodes[i] != NULL && nodes[i]->key <= hi && rb_end(nodes[i]) >= lo) expected++;
+    overlap_arg_t a = {lo, hi, 0, 0, 0};
+    assert(rbtree_overlaps(t, lo, hi, check_overlap, &a) == expected);
+#ifndef RBTREE_COUNTED
+    assert(a.visited == expected);                  // RBTREE_COUNTED는 같은 key를 노드 하나로 방문
+#endif
+    a.visited = 0;
+    a.limit = 1;                                    // 첫 구간에서 멈춤
+    rbtree_overlaps(t, lo, hi, check_overlap, &a);
+    assert(a.visited == (expected > 0));
+  }
+  assert(rbtree_overlaps(t, 1, 0, NULL, NULL) == 0);
+}
+
+void test_overlaps(const size_t n, const unsigned int seed) {
+  srand(seed);
+  const key_t range = (key_t)n * 4;
+  rbtree *t = new_rbtree();
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  for (size_t i = 0; i < n; i++) {
+    key_t lo = rand() % range;
+#ifdef RBTREE_INTERVAL
+    key_t hi = lo + (rand() % 8 == 0 ? rand() % range : rand() % 16);  // 대부분 짧고 가끔 긴 구간
+    nodes[i] = rbtree_insert_interval(t, lo, hi);
+    assert(nodes[i] != NULL && nodes[i]->key == lo && nodes[i]->end == hi);
+#else
+    nodes[i] = rbtree_insert(t, lo);
+#endif
+  }
+#ifdef RBTREE_INTERVAL
+  assert(rbtree_insert_interval(t, 1, 0) == NULL);
+#endif
+  test_color_constraint(t);
+  assert(size_traverse(t->root, t->nil) == n);
+  check_overlaps(t, nodes, n, range);
+
+  // 삭제 후에도 max_end가 맞는지 확인
+  for (size_t i = 0; i < n; i++) {
+    if (rand() % 2) continue;
+    assert(rbtree_erase(t, nodes[i]) == 1);
+    nodes[i] = NULL;
+  }
+  test_color_constraint(t);
+  size_traverse(t->root, t->nil);
+  check_overlaps(t, nodes, n, range);
+
+  // split/join으로 옮긴 노드도 구간을 유지
+  rbtree *lo, *hi;
+  assert(rbtree_split(t, range / 2, &lo, &hi) == 0);
+  size_traverse(lo->root, lo->nil);
+  size_traverse(hi->root, hi->nil);
+  assert(rbtree_join(lo, hi) == 0);
+  test_color_constraint(lo);
+  size_traverse(lo->root, lo->nil);
+  check_overlaps(lo, nodes, n, range);
+
+  delete_rbtree(hi);
+  delete_rbtree(lo);
+  delete_rbtree(t);
+  free(nodes);
+}
+
+// 자식의 parent가 모두 맞는지 확인하고 가장 낮은/높은 노드 주소를 구함
+static void compact_traverse(const node_t *p, const node_t *nil, const node_t **lo, const node_t **hi) {
+  for (; p != nil; p = p->right) {
+    if (p < *lo) *lo = p;
+    if (p > *hi) *hi = p;
+    assert(p->left == nil || rb_parent(p->left) == p);
+    assert(p->right == nil || rb_parent(p->right) == p);
+    compact_traverse(p->left, nil, lo, hi);
+  }
+}
+
+// cnt[k]개씩 있어야 하는 key가 tree에 그대로 있는지 확인
+static void check_counts(const rbtree *t, const size_t *cnt, const size_t range) {
+  size_t n = 0;
+  for (size_t k = 0; k < range; k++) n += cnt[k];
+  key_t *arr = calloc(n + 1, sizeof(key_t));
+  size_t m = 0;
+  for (size_t k = 0; k < range; k++)
+    for (size_t i = 0; i < cnt[k]; i++) arr[m++] = (key_t)k;
+  check_tree(t, arr, n);
+  const node_t *lo = (const node_t *)UINTPTR_MAX, *hi = NULL;
+  compact_traverse(t->root, t->nil, &lo, &hi);
+  free(arr);
+}
+
+// 삽입/삭제로 흩어진 tree를 재배치해도 내용이 그대로이고 노드가 연속된 자리에 모이는지 확인
+void test_compact(const size_t n, const unsigned int seed) {
+  srand(seed);
+  const size_t range = n / 2;
+  size_t *cnt = calloc(range, sizeof(size_t));
+  rbtree *t = new_rbtree();
+  assert(rbtree_compact(t) == 0);                   // 빈 tree
+  for (size_t i = 0; i < n * 2; i++) {              // 노드가 여러 chunk에 흩어지도록 섞어서 넣고 지움
+    key_t k = rand() % range;
+    node_t *p = rbtree_find(t, k);
+    if (p != NULL && rand() % 3 == 0) {
+      assert(rbtree_erase(t, p) == 1);
+      cnt[k]--;
+    } else {
+      assert(rbtree_insert(t, k) != NULL);
+      cnt[k]++;
+    }
+  }
+  const size_t before = rbtree_memory(t);
+  assert(rbtree_compact(t) == 0);
+  check_counts(t, cnt, range);
+  assert(rbtree_memory(t) <= before);
+  size_t nodes = 0;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) nodes++;
+  const node_t *lo = (const node_t *)UINTPTR_MAX, *hi = NULL;
+  compact_traverse(t->root, t->nil, &lo, &hi);
+  assert(lo == t->root && (size_t)(hi - lo) == nodes - 1);  // root부터 빈자리 없이 연속
+  for (size_t k = 0; k < range; k++) assert((rbtree_find(t, (key_t)k) != NULL) == (cnt[k] > 0));
+
+  // step 사이에 삽입/삭제가 섞여도 tree가 유지되어야 함
+  rbtree_compactor *c = rbtree_compact_begin(t, 64);
+  assert(c != NULL && rbtree_compact_begin(t, 0) == NULL);
+  int steps = 0;
+  while (rbtree_compact_step(c)) {
+    for (int i = 0; i < 16; i++) {
+      key_t k = rand() % range;
+      node_t *p = rbtree_find(t, k);
+      if (p != NULL && rand() % 2) {
+        assert(rbtree_erase(t, p) == 1);
+        cnt[k]--;
+      } else {
+        assert(rbtree_insert(t, k) != NULL);
+        cnt[k]++;
+      }
+    }
+    if (steps++ % 16 == 0) check_counts(t, cnt, range);
+  }
+  assert(steps > 1);
+  rbtree_compact_end(c);
+  check_counts(t, cnt, range);
+
+  // 같은 key가 길게 이어져도 step으로 나눠 모든 노드를 옮겨야 함
+  rbtree *d = new_rbtree();
+  for (size_t i = 0; i < n; i++) rbtree_insert(d, (key_t)(i % 4 == 0 ? i : 7));
+  c = rbtree_compact_begin(d, 32);
+  while (rbtree_compact_step(c));
+  rbtree_compact_end(c);
+  nodes = 0;
+  for (node_t *p = rbtree_min(d); p != NULL; p = rbtree_next(d, p)) nodes++;
+  lo = (const node_t *)UINTPTR_MAX;
+  hi = NULL;
+  compact_traverse(d->root, d->nil, &lo, &hi);
+  assert(lo == d->root && (size_t)(hi - lo) == nodes - 1);
+  delete_rbtree(d);
+
+  // pool을 공유하는 다른 tree의 노드는 그대로 남아야 함
+  rbtree *l, *r;
+  assert(rbtree_split(t, (key_t)(range / 2), &l, &r) == 0);
+  assert(rbtree_compact(l) == 0);
+  c = rbtree_compact_begin(r, 100);
+  while (rbtree_compact_step(c));
+  rbtree_compact_end(c);
+  assert(rbtree_join(l, r) == 0);
+  check_counts(l, cnt, range);
+
+  delete_rbtree(r);
+  delete_rbtree(l);
+  delete_rbtree(t);
+  free(cnt);
+}
+
+typedef struct {
+  rbtree_persistent *t;
+  int n;
+} persistent_arg_t;
+
+// writer가 계속 바꾸는 동안 snapshot을 잡아 두 번 읽고, 같은 정렬된 내용인지 확인
+static void *persistent_reader(void *arg) {
+  persistent_arg_t *a = (persistent_arg_t *)arg;
+  for (int i = 0; i < a->n; i++) {
+    rbtree_version *v = rbtree_snapshot(a->t);
+    size_t m = rbtree_version_size(v);
+    key_t *x = calloc(m + 1, sizeof(key_t)), *y = calloc(m + 1, sizeof(key_t));
+    rbtree_version_to_array(v, x, m);
+    sched_yield();
+    rbtree_version_to_array(v, y, m);
+    assert(memcmp(x, y, m * sizeof(key_t)) == 0);
+    for (size_t j = 1; j < m; j++) assert(x[j - 1] <= x[j]);
+    key_t key;
+    if (m > 0) assert(rbtree_version_min(v, &key) && key == x[0] && rbtree_version_max(v, &key) && key == x[m - 1]);
+    rbtree_snapshot_release(v);
+    free(x);
+    free(y);
+  }
+  return NULL;
+}
+
+void test_persistent(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree_persistent *t = new_rbtree_persistent();
+  rbtree *ref = new_rbtree();
+  const size_t nv = 10;
+  rbtree_version *vs[10];
+  key_t *expected[10];
+  size_t sizes[10];
+
+  // 변경 중간중간 잡은 snapshot은 이후의 변경과 관계없이 그때의 내용을 유지
+  for (size_t k = 0; k < nv; k++) {
+    for (size_t i = 0; i < n; i++) {
+      const key_t key = rand() % (n / 2);           // 중복 key도 섞임
+      if (rand() % 3) {
+        assert(rbtree_persistent_insert(t, key) == 0);
+        rbtree_insert(ref, key);
+      } else {
+        node_t *p = rbtree_find(ref, key);
+        assert(rbtree_persistent_erase(t, key) == (p != NULL));
+        if (p != NULL) rbtree_erase(ref, p);
+      }
+    }
+    assert(rbtree_persistent_size(t) == rbtree_size(ref));
+    vs[k] = rbtree_snapshot(t);
+    sizes[k] = rbtree_size(ref);
+    expected[k] = calloc(sizes[k] + 1, sizeof(key_t));
+    rbtree_to_array(ref, expected[k], sizes[k]);
+  }
+
+  rbtree_version *v = vs[nv - 1];
+  key_t key;
+  for (key_t x = -1; x <= (key_t)(n / 2); x++) {
+    node_t *p = rbtree_find(ref, x);
+    assert(rbtree_version_find(v, x) == (p != NULL));
+    node_t *q = rbtree_lower_bound(ref, x);
+    assert(rbtree_version_lower_bound(v, x, &key) == (q != NULL));
+    assert(q == NULL || key == q->key);
+  }
+  assert(rbtree_version_min(v, &key) && key == rbtree_min(ref)->key);
+  assert(rbtree_version_max(v, &key) && key == rbtree_max(ref)->key);
+
+  // writer를 먼저 지워도 snapshot은 남고, 어떤 순서로 놓아도 됨
+  while (rbtree_persistent_size(t) > 0) {
+    node_t *p = rbtree_min(ref);
+    assert(rbtree_persistent_erase(t, p->key) == 1);
+    rbtree_erase(ref, p);
+  }
+  assert(rbtree_persistent_erase(t, 0) == 0);
+  delete_rbtree_persistent(t);
+  for (size_t k = 0; k < nv; k++) {
+    size_t j = (k * 7) % nv;
+    key_t *arr = calloc(sizes[j] + 1, sizeof(key_t));
+    assert(rbtree_version_size(vs[j]) == sizes[j]);
+    rbtree_version_to_array(vs[j], arr, sizes[j]);
+    assert(memcmp(arr, expected[j], sizes[j] * sizeof(key_t)) == 0);
+    rbtree_snapshot_release(vs[j]);
+    free(arr);
+    free(expected[j]);
+  }
+  delete_rbtree(ref);
+
+  // writer 하나와 snapshot을 읽는 reader 여럿
+  t = new_rbtree_persistent();
+  pthread_t tid[3];
+  persistent_arg_t arg = {t, 200};
+  for (int i = 0; i < 3; i++) pthread_create(&tid[i], NULL, persistent_reader, &arg);
+  for (size_t i = 0; i < n; i++) {
+    assert(rbtree_persistent_insert(t, rand() % 1000) == 0);
+    if (i % 2) rbtree_persistent_erase(t, rand() % 1000);
+  }
+  for (int i = 0; i < 3; i++) pthread_join(tid[i], NULL);
+  delete_rbtree_persistent(t);
+}
+
 int main(void) {
   test_init();
   test_insert_single(1024);
@@ -375,9 +1879,36 @@ int main(void) {
   test_find_erase_fixed();
   test_minmax_suite();
   test_to_array_suite();
+  test_export(300000, 107);
   test_distinct_values();
   test_duplicate_values();
   test_multi_instance();
   test_find_erase_rand(10000, 17);
+  test_reserve(1000);
+  test_from_array(10000, 29);
+  test_find_batch(10000, 53);
+  test_order_statistic(10000, 31);
+  test_join_split(10000, 59);
+  test_set_operations(10000, 61);
+  test_erase_range(10000, 67);
+  test_pop(10000, 71);
+  test_insert_hint(10000, 73);
+  test_stats(10000, 79);
+  test_iterator(10000, 37);
+  test_freeze_suite();
+  test_save_load(0, 83);
+  test_save_load(1, 89);
+  test_save_load(200000, 97);
+  test_wal(10000, 101);
+  test_mt(20000);
+  test_sharded(10000, 43);
+  test_generic(10000, 47);
+  test_intrusive(10000, 103);
+  test_persistent(10000, 109);
+  test_overlaps(10000, 113);
+  test_compact(10000, 127);
+#ifdef RBTREE_COUNTED
+  test_counted(10000);
+#endif
   printf("Passed all tests!\n");
 }